@@ -17,8 +17,13 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 
 //#include <stdbool.h>
@@ -26,17 +31,34 @@
 #define true 1
 #define false 0
 
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_TARGET
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 
 #define HACK		/* can issue no-arguments (W0) mfr-specific calls */
 
@@ -60,6 +82,7 @@ typedef __u8 u8;
 typedef __u16 u16;
 typedef __s8 s8;
 typedef __s16 s16;
+typedef __u64 u64;
 
 enum pmbus_cmd_type {
 	/* _undef_ = 0, */
@@ -118,13 +141,28 @@ struct pmbus_coefficients {
 	s8	R;
 	s16	m;
 	s16	b;
+
+	/* Precomputed from those, so decoding is one multiply-add:
+	 *  X = ((Y * (10 ^ -R)) - b) / m = Y * scale + offset
+	 */
+	double	exp10_R;	/* 10 ^ R */
+	double	scale;
+	double	offset;
+
+	/* ... or, without floating point, in thousandths (see "-M"):
+	 *  1000 * X = (Y * milli_mul - milli_off) / milli_div
+	 */
+	u8		milli_ok;	/* else |R| is too big */
+	long long	milli_mul;
+	long long	milli_off;
+	long long	milli_div;
 };
 
 /*
  * This struct captures the PMBus 1.1 command summary data, in Part II
- * Appendix I of the spec and updated to include units.  It's set up so
- * it can be easily augmented with device-specfic query data and other
- * data as needed to work with these commands.
+ * Appendix I of the spec and updated to include units.  It's constant;
+ * what each device says about the command (QUERY data, coefficients)
+ * is kept per device, in struct pmbus_cmd_state.
  */
 
 struct pmbus_cmd_desc {
@@ -136,12 +174,15 @@ struct pmbus_cmd_desc {
 
 	/* data just for this utility */
 	u8		flags;
+	u8		poll;		/* POLL_* class */
 #if 0
-	void		(*decode)(struct pmbus_cmd_desc *op, int value);
+	void		(*decode)(const struct pmbus_cmd_desc *op, int value);
 	// REVISIT encode too
 #endif
+};
 
-	/* from device (variable) */
+/* from device (variable) */
+struct pmbus_cmd_state {
 	u8		query;
 	struct pmbus_coefficients c[2];	/* 0 = w, 1 = r */
 };
@@ -149,6 +190,7 @@ struct pmbus_cmd_desc {
 /* some of the command codes found in pmbus_cmd_desc.cmd;
  * these are specifically recognized in this code.
  */
+#define PMB_PAGE		0x00
 #define PMB_CLEAR_FAULT		0x03
 #define PMB_CAPABILITY		0x19
 #define PMB_QUERY		0x1a
@@ -189,6 +231,12 @@ struct pmbus_cmd_desc {
 #define FLG_STATUS		(1 << 1)
 #define FLG_FORMAT_VOUT		(1 << 2)
 
+/* for pmbus_cmd_desc.poll:  how often the daemon rereads the value */
+#define POLL_STATIC		0	/* inventory, limits, configuration */
+#define POLL_SLOW		1	/* temperatures, fans, etc */
+#define POLL_FAST		2	/* status, voltage, current, power */
+#define POLL_CLASSES		3
+
 static inline int is_pmb_8bit(u16 cmd)
 {
 	/* pure 8 bit command */
@@ -204,274 +252,310 @@ static inline int is_pmb_extended(u16 cmd)
 /*----------------------------------------------------------------------*/
 
 /*
- * NOTE:  first version expects these static values to be morphed
- * in place ... maximum of one device per process.  To support more
- * than one PMBus device per process, make this table "const" then
- * use these as examplars.
+ * NOTE:  this table is shared by all devices; anything learned from
+ * a device goes into its pmbus_dev.state[] instead.
+ *
+ * It's indexed by command code, so lookups are constant time.  Listing
+ * a code twice is a build error, courtesy of -Werror=override-init in
+ * the Makefile.  Unlisted codes have NULL tags.
  *
  * REVISIT more of these should probably have units...
  */
-static struct pmbus_cmd_desc pmbus_ops[] = {
+#define PMB_OP(c, ...)	[c] = { .cmd = (c), __VA_ARGS__ }
+
+static const struct pmbus_cmd_desc pmbus_ops[256] = {
 
 /* These are in numeric order, modulo sequence gaps in the PMBus spec. */
 
-{ .cmd = 0x00, .tag = "page", .type = RW1, },
-{ .cmd = 0x01, .tag = "operation", .type = RW1, },
-{ .cmd = 0x02, .tag = "on_off_config", .type = RW1, },
-{ .cmd = PMB_CLEAR_FAULT, .tag = "clear_fault", .type = W0, },
-{ .cmd = 0x04, .tag = "phase", .type = RW1, },
-{ .cmd = 0x05, .tag = "page_plus_write", .type = RWB, },
-{ .cmd = 0x05, .tag = "page_plus_read", .type = RWB, },
-
-{ .cmd = 0x10, .tag = "write_protect", .type = RW1, },
-{ .cmd = 0x11, .tag = "store_default_all", .type = W0, },
-{ .cmd = 0x12, .tag = "restore_default_all", .type = W0, },
-{ .cmd = 0x13, .tag = "store_default_code", .type = W1, },
-{ .cmd = 0x14, .tag = "restore_default_code", .type = W1, },
-{ .cmd = 0x15, .tag = "store_user_all", .type = W0, },
-{ .cmd = 0x16, .tag = "restore_user_all", .type = W0, },
-{ .cmd = 0x17, .tag = "store_user_code", .type = W1, },
-{ .cmd = 0x18, .tag = "restore_user_code", .type = W1, },
-{ .cmd = PMB_CAPABILITY, .tag = "capability", .type = R1,
-		.flags = FLG_SHOW_P1, },
-{ .cmd = PMB_QUERY, .tag = "query", .type = RWP_QUERY, },
-{ .cmd = 0x1b, .tag = "smbalert_mask", .type = RWB, },
-
-{ .cmd = PMB_VOUT_MODE, .tag = "vout_mode", .type = RW1, },
-{ .cmd = 0x21, .tag = "vout_command", .type = RW2, },
-{ .cmd = 0x22, .tag = "vout_trim", .type = RW2, .units = VOLTS, },
-{ .cmd = 0x23, .tag = "vout_cal_offset", .type = RW2, .units = VOLTS, },
-{ .cmd = 0x24, .tag = "vout_max", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT },
-{ .cmd = 0x25, .tag = "vout_margin_high", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-{ .cmd = 0x26, .tag = "vout_margin_low", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-{ .cmd = 0x27, .tag = "vout_transition_rate", .type = RW2, },
-{ .cmd = 0x28, .tag = "vout_droop", .type = RW2, },
-{ .cmd = 0x29, .tag = "vout_scale_loop", .type = RW2, },
-{ .cmd = 0x2a, .tag = "vout_scale_monitor", .type = RW2, },
-
-{ .cmd = PMB_COEFFICIENTS, .tag = "coefficients", .type = RWP_COEFF, },
-{ .cmd = 0x31, .tag = "pout_max", .type = RW2, .units = WATTS, },
-{ .cmd = 0x32, .tag = "max_duty", .type = RW2, },
-{ .cmd = 0x33, .tag = "frequency_switch", .type = RW2, },
-{ .cmd = 0x35, .tag = "vin_on", .type = RW2, .units = VOLTS, },
-{ .cmd = 0x36, .tag = "vin_off", .type = RW2, .units = VOLTS, },
-{ .cmd = 0x37, .tag = "interleave", .type = RW2, },
-{ .cmd = 0x38, .tag = "iout_cal_gain", .type = RW2, },
-{ .cmd = 0x39, .tag = "iout_cal_offset", .type = RW2, .units = AMPERES, },
-{ .cmd = 0x3a, .tag = "fan_config_1_2", .type = RW1, },
-{ .cmd = 0x3b, .tag = "fan_command_1", .type = RW2, },
-{ .cmd = 0x3c, .tag = "fan_command_2", .type = RW2, },
-{ .cmd = 0x3d, .tag = "fan_config_3_4", .type = RW1, },
-{ .cmd = 0x3e, .tag = "fan_command_3", .type = RW2, },
-{ .cmd = 0x3f, .tag = "fan_command_4", .type = RW2, },
-
-{ .cmd = 0x40, .tag = "vout_ov_fault_limit", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-{ .cmd = 0x41, .tag = "vout_ov_fault_response", .type = RW1, },
-{ .cmd = 0x42, .tag = "vout_ov_warn_limit", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-{ .cmd = 0x43, .tag = "vout_uv_warn_limit", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-{ .cmd = 0x44, .tag = "vout_uv_fault_limit", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-{ .cmd = 0x45, .tag = "vout_uv_fault_response", .type = RW1, },
-{ .cmd = 0x46, .tag = "iout_oc_fault_limit", .type = RW2, .units = AMPERES, },
-{ .cmd = 0x47, .tag = "iout_oc_fault_response", .type = RW1, },
-{ .cmd = 0x48, .tag = "iout_oc_lv_fault_limit",
-		.type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-{ .cmd = 0x49, .tag = "iout_oc_lv_fault_response", .type = RW1, },
-{ .cmd = 0x4a, .tag = "iout_oc_warn_limit", .type = RW2, .units = AMPERES, },
-{ .cmd = 0x4b, .tag = "iout_uc_fault_limit", .type = RW2, .units = AMPERES, },
-{ .cmd = 0x4c, .tag = "iout_uc_fault_response", .type = RW1, },
-
-{ .cmd = 0x4f, .tag = "ot_fault_limit", .type = RW2, .units = DEGREES_C,},
-
-{ .cmd = 0x50, .tag = "ot_fault_response", .type = RW1, },
-{ .cmd = 0x51, .tag = "ot_warn_limit", .type = RW2, .units = DEGREES_C,},
-{ .cmd = 0x52, .tag = "ut_warn_limit", .type = RW2, .units = DEGREES_C,},
-{ .cmd = 0x53, .tag = "ut_fault_limit", .type = RW2, .units = DEGREES_C,},
-{ .cmd = 0x54, .tag = "ut_fault_response", .type = RW1, },
-{ .cmd = 0x55, .tag = "vin_ov_fault_limit", .type = RW2, .units = VOLTS, },
-{ .cmd = 0x56, .tag = "vin_ov_fault_response", .type = RW1, },
-{ .cmd = 0x57, .tag = "vin_ov_warn_limit", .type = RW2, .units = VOLTS, },
-{ .cmd = 0x58, .tag = "vin_uv_warn_limit", .type = RW2, .units = VOLTS, },
-{ .cmd = 0x59, .tag = "vin_uv_fault_limit", .type = RW2, .units = VOLTS, },
-{ .cmd = 0x5a, .tag = "vin_uv_fault_response", .type = RW1, },
-{ .cmd = 0x5b, .tag = "iin_oc_fault_limit", .type = RW2, .units = AMPERES, },
-{ .cmd = 0x5c, .tag = "iin_oc_fault_response", .type = RW1, },
-{ .cmd = 0x5d, .tag = "iin_oc_warn_limit", .type = RW2, .units = AMPERES, },
-{ .cmd = 0x5e, .tag = "power_good_on", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-{ .cmd = 0x5f, .tag = "power_good_off", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-
-{ .cmd = 0x60, .tag = "ton_delay", .type = RW2, .units = MILLISECONDS, },
-{ .cmd = 0x61, .tag = "ton_rise", .type = RW2, .units = MILLISECONDS, },
-{ .cmd = 0x62, .tag = "ton_max_fault_limit",
-		.type = RW2, .units = MILLISECONDS, },
-{ .cmd = 0x63, .tag = "ton_max_fault_response", .type = RW1, },
-{ .cmd = 0x64, .tag = "toff_delay", .type = RW2, .units = MILLISECONDS, },
-{ .cmd = 0x65, .tag = "toff_fall", .type = RW2, .units = MILLISECONDS, },
-{ .cmd = 0x66, .tag = "toff_max_warn_limit",
-		.type = RW2, .units = MILLISECONDS, },
-
-{ .cmd = 0x68, .tag = "pout_op_fault_limit", .type = RW2, .units = WATTS, },
-{ .cmd = 0x69, .tag = "pout_op_fault_response", .type = RW1, },
-{ .cmd = 0x6a, .tag = "pout_op_warn_limit", .type = RW2, .units = WATTS, },
-{ .cmd = 0x6b, .tag = "pin_op_warn_limit", .type = RW2, .units = WATTS, },
-
-{ .cmd = PMB_STATUS_BYTE, .tag = "status_byte", .type = R1,
-		.flags = FLG_STATUS, },
-{ .cmd = PMB_STATUS_WORD, .tag = "status_word", .type = R2, .units = BITS,
-		.flags = FLG_STATUS, },
-{ .cmd = PMB_STATUS_VOUT, .tag = "status_vout", .type = R1,
-		.flags = FLG_STATUS, },
-{ .cmd = PMB_STATUS_IOUT, .tag = "status_iout", .type = R1,
-		.flags = FLG_STATUS, },
-{ .cmd = PMB_STATUS_INPUT, .tag = "status_input", .type = R1,
-		.flags = FLG_STATUS, },
-{ .cmd = PMB_STATUS_TEMPERATURE, .tag = "status_temperature", .type = R1,
-		.flags = FLG_STATUS, },
-{ .cmd = PMB_STATUS_CML, .tag = "status_cml", .type = R1,
-		.flags = FLG_STATUS, },
-{ .cmd = PMB_STATUS_OTHER, .tag = "status_other", .type = R1,
-		.flags = FLG_STATUS, },
-
-{ .cmd = PMB_STATUS_MFR_SPECIFIC, .tag = "status_mfr_specific", .type = R1,
-		.flags = FLG_STATUS, },
-{ .cmd = PMB_STATUS_FANS_1_2, .tag = "status_fans_1_2", .type = R1,
-		.flags = FLG_STATUS, },
-{ .cmd = PMB_STATUS_FANS_3_4, .tag = "status_fans_3_4", .type = R1,
-		.flags = FLG_STATUS, },
-
-{ .cmd = 0x86, .tag = "read_ein", .type = ENERGY, },
-{ .cmd = 0x87, .tag = "read_eout", .type = ENERGY, },
-{ .cmd = 0x88, .tag = "read_vin", .type = R2, .units = VOLTS, },
-{ .cmd = 0x89, .tag = "read_iin", .type = R2, .units = AMPERES, },
-{ .cmd = 0x8a, .tag = "read_vcap", .type = R2, .units = VOLTS, },
-{ .cmd = 0x8b, .tag = "read_vout", .type = R2, .units = VOLTS, .flags = FLG_FORMAT_VOUT, },
-{ .cmd = 0x8c, .tag = "read_iout", .type = R2, .units = AMPERES, },
-{ .cmd = 0x8d, .tag = "read_temperature_1", .type = R2, .units = DEGREES_C, },
-{ .cmd = 0x8e, .tag = "read_temperature_2", .type = R2, .units = DEGREES_C, },
-{ .cmd = 0x8f, .tag = "read_temperature_3", .type = R2, .units = DEGREES_C, },
-
-{ .cmd = 0x90, .tag = "read_fan_speed_1", .type = R2, },
-{ .cmd = 0x91, .tag = "read_fan_speed_2", .type = R2, },
-{ .cmd = 0x92, .tag = "read_fan_speed_3", .type = R2, },
-{ .cmd = 0x93, .tag = "read_fan_speed_4", .type = R2, },
-{ .cmd = 0x94, .tag = "read_duty_cycle", .type = R2, },
-{ .cmd = 0x95, .tag = "read_frequency", .type = R2, },
-{ .cmd = 0x96, .tag = "read_pout", .type = R2, .units = WATTS, },
-{ .cmd = 0x97, .tag = "read_pin", .type = R2, .units = WATTS, },
-{ .cmd = PMB_PMBUS_REVISION, .tag = "pmbus_revision", .type = R1,
-		.flags = FLG_SHOW_P1, },
-{ .cmd = PMB_MFR_ID, .tag = "mfr_id", .type = RWB,
-		.units = STRING, .flags = FLG_SHOW_P1, },
-{ .cmd = PMB_MFR_MODEL, .tag = "mfr_model", .type = RWB,
-		.units = STRING, .flags = FLG_SHOW_P1, },
-{ .cmd = PMB_MFR_REVISION, .tag = "mfr_revision", .type = RWB,
-		.units = STRING, .flags = FLG_SHOW_P1, },
-{ .cmd = PMB_MFR_LOCATION, .tag = "mfr_location", .type = RWB,
-		.units = STRING, .flags = FLG_SHOW_P1, },
-{ .cmd = PMB_MFR_DATE, .tag = "mfr_date", .type = RWB,
-		.units = STRING, .flags = FLG_SHOW_P1, },
-{ .cmd = PMB_MFR_SERIAL, .tag = "mfr_serial", .type = RWB,
-		.units = STRING, .flags = FLG_SHOW_P1, },
-{ .cmd = PMB_APP_PROFILES, .tag = "app_profile_support",
-		.type = RWB_APP_PROFILE, .flags = FLG_SHOW_P1, },
-
-{ .cmd = 0xa0, .tag = "mfr_vin_min", .type = R2, .units = VOLTS, },
-{ .cmd = 0xa1, .tag = "mfr_vin_max", .type = R2, .units = VOLTS, },
-{ .cmd = 0xa2, .tag = "mfr_iin_max", .type = R2, .units = AMPERES, },
-{ .cmd = 0xa3, .tag = "mfr_pin_max", .type = R2, .units = WATTS, },
-{ .cmd = 0xa4, .tag = "mfr_vout_min", .type = R2, .units = VOLTS, },
-{ .cmd = 0xa5, .tag = "mfr_vout_max", .type = R2, .units = VOLTS, },
-{ .cmd = 0xa5, .tag = "mfr_iout_max", .type = R2, .units = AMPERES, },
-{ .cmd = 0xa7, .tag = "mfr_pout_max", .type = R2, .units = WATTS, },
-{ .cmd = 0xa8, .tag = "mfr_tambient_max", .type = R2, .units = DEGREES_C, },
-{ .cmd = 0xa9, .tag = "mfr_tambient_min", .type = R2, .units = DEGREES_C, },
-{ .cmd = 0xaa, .tag = "mfr_efficiency_ll", .type = RWB14, },
-{ .cmd = 0xab, .tag = "mfr_efficiency_hl", .type = RWB14, },
-{ .cmd = 0xac, .tag = "mfr_pin_accuracy", .type = R1, },
-{ .cmd = PMB_IC_DEVICE_ID, .tag = "ic_device_id", .type = RWB,
-		.units = STRING, .flags = FLG_SHOW_P1, },
-{ .cmd = PMB_IC_DEVICE_REV, .tag = "ic_device_rev", .type = RWB,
-		.units = STRING, .flags = FLG_SHOW_P1, },
-
-{ .cmd = PMB_USER_DATA(0),  .tag = "user_data_00", .type = RWB, },
-{ .cmd = PMB_USER_DATA(1),  .tag = "user_data_01", .type = RWB, },
-{ .cmd = PMB_USER_DATA(2),  .tag = "user_data_02", .type = RWB, },
-{ .cmd = PMB_USER_DATA(3),  .tag = "user_data_03", .type = RWB, },
-{ .cmd = PMB_USER_DATA(4),  .tag = "user_data_04", .type = RWB, },
-{ .cmd = PMB_USER_DATA(5),  .tag = "user_data_05", .type = RWB, },
-{ .cmd = PMB_USER_DATA(6),  .tag = "user_data_06", .type = RWB, },
-{ .cmd = PMB_USER_DATA(7),  .tag = "user_data_07", .type = RWB, },
-{ .cmd = PMB_USER_DATA(8),  .tag = "user_data_08", .type = RWB, },
-{ .cmd = PMB_USER_DATA(9),  .tag = "user_data_09", .type = RWB, },
-{ .cmd = PMB_USER_DATA(10), .tag = "user_data_10", .type = RWB, },
-{ .cmd = PMB_USER_DATA(11), .tag = "user_data_11", .type = RWB, },
-{ .cmd = PMB_USER_DATA(12), .tag = "user_data_12", .type = RWB, },
-{ .cmd = PMB_USER_DATA(13), .tag = "user_data_13", .type = RWB, },
-{ .cmd = PMB_USER_DATA(14), .tag = "user_data_14", .type = RWB, },
-{ .cmd = PMB_USER_DATA(15), .tag = "user_data_15", .type = RWB, },
-
-{ .cmd = 0xc0, .tag = "mfr_max_temp_1", .type = RW2, .units = DEGREES_C, },
-{ .cmd = 0xc1, .tag = "mfr_max_temp_1", .type = RW2, .units = DEGREES_C, },
-{ .cmd = 0xc2, .tag = "mfr_max_temp_1", .type = RW2, .units = DEGREES_C, },
-
-{ .cmd = PMB_MFR_SPECIFIC(0),  .tag = "mfr_specific_00", },
-{ .cmd = PMB_MFR_SPECIFIC(1),  .tag = "mfr_specific_01", },
-{ .cmd = PMB_MFR_SPECIFIC(2),  .tag = "mfr_specific_02", },
-{ .cmd = PMB_MFR_SPECIFIC(3),  .tag = "mfr_specific_03", },
-{ .cmd = PMB_MFR_SPECIFIC(4),  .tag = "mfr_specific_04", },
-{ .cmd = PMB_MFR_SPECIFIC(5),  .tag = "mfr_specific_05", },
-{ .cmd = PMB_MFR_SPECIFIC(6),  .tag = "mfr_specific_06", },
-{ .cmd = PMB_MFR_SPECIFIC(7),  .tag = "mfr_specific_07", },
-{ .cmd = PMB_MFR_SPECIFIC(8),  .tag = "mfr_specific_08", },
-{ .cmd = PMB_MFR_SPECIFIC(9),  .tag = "mfr_specific_09", },
-{ .cmd = PMB_MFR_SPECIFIC(10), .tag = "mfr_specific_10", },
-{ .cmd = PMB_MFR_SPECIFIC(11), .tag = "mfr_specific_11", },
-{ .cmd = PMB_MFR_SPECIFIC(12), .tag = "mfr_specific_12", },
-{ .cmd = PMB_MFR_SPECIFIC(13), .tag = "mfr_specific_13", },
-{ .cmd = PMB_MFR_SPECIFIC(14), .tag = "mfr_specific_14", },
-{ .cmd = PMB_MFR_SPECIFIC(15), .tag = "mfr_specific_15", },
-
-{ .cmd = PMB_MFR_SPECIFIC(16), .tag = "mfr_specific_16", },
-{ .cmd = PMB_MFR_SPECIFIC(17), .tag = "mfr_specific_17", },
-{ .cmd = PMB_MFR_SPECIFIC(18), .tag = "mfr_specific_18", },
-{ .cmd = PMB_MFR_SPECIFIC(19), .tag = "mfr_specific_19", },
-{ .cmd = PMB_MFR_SPECIFIC(20), .tag = "mfr_specific_20", },
-{ .cmd = PMB_MFR_SPECIFIC(21), .tag = "mfr_specific_21", },
-{ .cmd = PMB_MFR_SPECIFIC(22), .tag = "mfr_specific_22", },
-{ .cmd = PMB_MFR_SPECIFIC(23), .tag = "mfr_specific_23", },
-{ .cmd = PMB_MFR_SPECIFIC(24), .tag = "mfr_specific_24", },
-{ .cmd = PMB_MFR_SPECIFIC(25), .tag = "mfr_specific_25", },
-{ .cmd = PMB_MFR_SPECIFIC(26), .tag = "mfr_specific_26", },
-{ .cmd = PMB_MFR_SPECIFIC(27), .tag = "mfr_specific_27", },
-{ .cmd = PMB_MFR_SPECIFIC(29), .tag = "mfr_specific_28", },
-{ .cmd = PMB_MFR_SPECIFIC(29), .tag = "mfr_specific_29", },
-{ .cmd = PMB_MFR_SPECIFIC(30), .tag = "mfr_specific_30", },
-{ .cmd = PMB_MFR_SPECIFIC(31), .tag = "mfr_specific_31", },
-
-{ .cmd = PMB_MFR_SPECIFIC(32), .tag = "mfr_specific_32", },
-{ .cmd = PMB_MFR_SPECIFIC(33), .tag = "mfr_specific_33", },
-{ .cmd = PMB_MFR_SPECIFIC(34), .tag = "mfr_specific_34", },
-{ .cmd = PMB_MFR_SPECIFIC(35), .tag = "mfr_specific_35", },
-{ .cmd = PMB_MFR_SPECIFIC(36), .tag = "mfr_specific_36", },
-{ .cmd = PMB_MFR_SPECIFIC(37), .tag = "mfr_specific_37", },
-{ .cmd = PMB_MFR_SPECIFIC(38), .tag = "mfr_specific_38", },
-{ .cmd = PMB_MFR_SPECIFIC(39), .tag = "mfr_specific_39", },
-{ .cmd = PMB_MFR_SPECIFIC(40), .tag = "mfr_specific_40", },
-{ .cmd = PMB_MFR_SPECIFIC(41), .tag = "mfr_specific_41", },
-{ .cmd = PMB_MFR_SPECIFIC(42), .tag = "mfr_specific_42", },
-{ .cmd = PMB_MFR_SPECIFIC(43), .tag = "mfr_specific_43", },
-{ .cmd = PMB_MFR_SPECIFIC(44), .tag = "mfr_specific_44", },
-{ .cmd = PMB_MFR_SPECIFIC(45), .tag = "mfr_specific_45", },
-{ .cmd = 0xfe, .tag = "mfr_specific_command_ext", },
-{ .cmd = 0xff, .tag = "pmbus_command_ext", },
-
-{ /* ZEROES TERMINATE THIS LIST */ },
+PMB_OP(PMB_PAGE, .tag = "page", .type = RW1),
+PMB_OP(0x01, .tag = "operation", .type = RW1),
+PMB_OP(0x02, .tag = "on_off_config", .type = RW1),
+PMB_OP(PMB_CLEAR_FAULT, .tag = "clear_fault", .type = W0),
+PMB_OP(0x04, .tag = "phase", .type = RW1),
+PMB_OP(0x05, .tag = "page_plus_write", .type = RWB),
+PMB_OP(0x06, .tag = "page_plus_read", .type = RWB),
+
+PMB_OP(0x10, .tag = "write_protect", .type = RW1),
+PMB_OP(0x11, .tag = "store_default_all", .type = W0),
+PMB_OP(0x12, .tag = "restore_default_all", .type = W0),
+PMB_OP(0x13, .tag = "store_default_code", .type = W1),
+PMB_OP(0x14, .tag = "restore_default_code", .type = W1),
+PMB_OP(0x15, .tag = "store_user_all", .type = W0),
+PMB_OP(0x16, .tag = "restore_user_all", .type = W0),
+PMB_OP(0x17, .tag = "store_user_code", .type = W1),
+PMB_OP(0x18, .tag = "restore_user_code", .type = W1),
+PMB_OP(PMB_CAPABILITY, .tag = "capability", .type = R1,
+		.flags = FLG_SHOW_P1),
+PMB_OP(PMB_QUERY, .tag = "query", .type = RWP_QUERY),
+PMB_OP(0x1b, .tag = "smbalert_mask", .type = RWB),
+
+PMB_OP(PMB_VOUT_MODE, .tag = "vout_mode", .type = RW1),
+PMB_OP(0x21, .tag = "vout_command", .type = RW2),
+PMB_OP(0x22, .tag = "vout_trim", .type = RW2, .units = VOLTS),
+PMB_OP(0x23, .tag = "vout_cal_offset", .type = RW2, .units = VOLTS),
+PMB_OP(0x24, .tag = "vout_max", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+PMB_OP(0x25, .tag = "vout_margin_high", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+PMB_OP(0x26, .tag = "vout_margin_low", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+PMB_OP(0x27, .tag = "vout_transition_rate", .type = RW2),
+PMB_OP(0x28, .tag = "vout_droop", .type = RW2),
+PMB_OP(0x29, .tag = "vout_scale_loop", .type = RW2),
+PMB_OP(0x2a, .tag = "vout_scale_monitor", .type = RW2),
+
+PMB_OP(PMB_COEFFICIENTS, .tag = "coefficients", .type = RWP_COEFF),
+PMB_OP(0x31, .tag = "pout_max", .type = RW2, .units = WATTS),
+PMB_OP(0x32, .tag = "max_duty", .type = RW2),
+PMB_OP(0x33, .tag = "frequency_switch", .type = RW2),
+PMB_OP(0x35, .tag = "vin_on", .type = RW2, .units = VOLTS),
+PMB_OP(0x36, .tag = "vin_off", .type = RW2, .units = VOLTS),
+PMB_OP(0x37, .tag = "interleave", .type = RW2),
+PMB_OP(0x38, .tag = "iout_cal_gain", .type = RW2),
+PMB_OP(0x39, .tag = "iout_cal_offset", .type = RW2, .units = AMPERES),
+PMB_OP(0x3a, .tag = "fan_config_1_2", .type = RW1),
+PMB_OP(0x3b, .tag = "fan_command_1", .type = RW2),
+PMB_OP(0x3c, .tag = "fan_command_2", .type = RW2),
+PMB_OP(0x3d, .tag = "fan_config_3_4", .type = RW1),
+PMB_OP(0x3e, .tag = "fan_command_3", .type = RW2),
+PMB_OP(0x3f, .tag = "fan_command_4", .type = RW2),
+
+PMB_OP(0x40, .tag = "vout_ov_fault_limit", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+PMB_OP(0x41, .tag = "vout_ov_fault_response", .type = RW1),
+PMB_OP(0x42, .tag = "vout_ov_warn_limit", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+PMB_OP(0x43, .tag = "vout_uv_warn_limit", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+PMB_OP(0x44, .tag = "vout_uv_fault_limit", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+PMB_OP(0x45, .tag = "vout_uv_fault_response", .type = RW1),
+PMB_OP(0x46, .tag = "iout_oc_fault_limit", .type = RW2, .units = AMPERES),
+PMB_OP(0x47, .tag = "iout_oc_fault_response", .type = RW1),
+PMB_OP(0x48, .tag = "iout_oc_lv_fault_limit",
+		.type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+PMB_OP(0x49, .tag = "iout_oc_lv_fault_response", .type = RW1),
+PMB_OP(0x4a, .tag = "iout_oc_warn_limit", .type = RW2, .units = AMPERES),
+PMB_OP(0x4b, .tag = "iout_uc_fault_limit", .type = RW2, .units = AMPERES),
+PMB_OP(0x4c, .tag = "iout_uc_fault_response", .type = RW1),
+
+PMB_OP(0x4f, .tag = "ot_fault_limit", .type = RW2, .units = DEGREES_C),
+
+PMB_OP(0x50, .tag = "ot_fault_response", .type = RW1),
+PMB_OP(0x51, .tag = "ot_warn_limit", .type = RW2, .units = DEGREES_C),
+PMB_OP(0x52, .tag = "ut_warn_limit", .type = RW2, .units = DEGREES_C),
+PMB_OP(0x53, .tag = "ut_fault_limit", .type = RW2, .units = DEGREES_C),
+PMB_OP(0x54, .tag = "ut_fault_response", .type = RW1),
+PMB_OP(0x55, .tag = "vin_ov_fault_limit", .type = RW2, .units = VOLTS),
+PMB_OP(0x56, .tag = "vin_ov_fault_response", .type = RW1),
+PMB_OP(0x57, .tag = "vin_ov_warn_limit", .type = RW2, .units = VOLTS),
+PMB_OP(0x58, .tag = "vin_uv_warn_limit", .type = RW2, .units = VOLTS),
+PMB_OP(0x59, .tag = "vin_uv_fault_limit", .type = RW2, .units = VOLTS),
+PMB_OP(0x5a, .tag = "vin_uv_fault_response", .type = RW1),
+PMB_OP(0x5b, .tag = "iin_oc_fault_limit", .type = RW2, .units = AMPERES),
+PMB_OP(0x5c, .tag = "iin_oc_fault_response", .type = RW1),
+PMB_OP(0x5d, .tag = "iin_oc_warn_limit", .type = RW2, .units = AMPERES),
+PMB_OP(0x5e, .tag = "power_good_on", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+PMB_OP(0x5f, .tag = "power_good_off", .type = RW2, .units = VOLTS, .flags = FLG_FORMAT_VOUT),
+
+PMB_OP(0x60, .tag = "ton_delay", .type = RW2, .units = MILLISECONDS),
+PMB_OP(0x61, .tag = "ton_rise", .type = RW2, .units = MILLISECONDS),
+PMB_OP(0x62, .tag = "ton_max_fault_limit",
+		.type = RW2, .units = MILLISECONDS),
+PMB_OP(0x63, .tag = "ton_max_fault_response", .type = RW1),
+PMB_OP(0x64, .tag = "toff_delay", .type = RW2, .units = MILLISECONDS),
+PMB_OP(0x65, .tag = "toff_fall", .type = RW2, .units = MILLISECONDS),
+PMB_OP(0x66, .tag = "toff_max_warn_limit",
+		.type = RW2, .units = MILLISECONDS),
+
+PMB_OP(0x68, .tag = "pout_op_fault_limit", .type = RW2, .units = WATTS),
+PMB_OP(0x69, .tag = "pout_op_fault_response", .type = RW1),
+PMB_OP(0x6a, .tag = "pout_op_warn_limit", .type = RW2, .units = WATTS),
+PMB_OP(0x6b, .tag = "pin_op_warn_limit", .type = RW2, .units = WATTS),
+
+PMB_OP(PMB_STATUS_BYTE, .tag = "status_byte", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+PMB_OP(PMB_STATUS_WORD, .tag = "status_word", .type = R2, .units = BITS,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+PMB_OP(PMB_STATUS_VOUT, .tag = "status_vout", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+PMB_OP(PMB_STATUS_IOUT, .tag = "status_iout", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+PMB_OP(PMB_STATUS_INPUT, .tag = "status_input", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+PMB_OP(PMB_STATUS_TEMPERATURE, .tag = "status_temperature", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+PMB_OP(PMB_STATUS_CML, .tag = "status_cml", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+PMB_OP(PMB_STATUS_OTHER, .tag = "status_other", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+
+PMB_OP(PMB_STATUS_MFR_SPECIFIC, .tag = "status_mfr_specific", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+PMB_OP(PMB_STATUS_FANS_1_2, .tag = "status_fans_1_2", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+PMB_OP(PMB_STATUS_FANS_3_4, .tag = "status_fans_3_4", .type = R1,
+		.flags = FLG_STATUS, .poll = POLL_FAST),
+
+PMB_OP(0x86, .tag = "read_ein", .type = ENERGY),
+PMB_OP(0x87, .tag = "read_eout", .type = ENERGY),
+PMB_OP(0x88, .tag = "read_vin", .type = R2, .units = VOLTS, .poll = POLL_FAST),
+PMB_OP(0x89, .tag = "read_iin", .type = R2, .units = AMPERES, .poll = POLL_FAST),
+PMB_OP(0x8a, .tag = "read_vcap", .type = R2, .units = VOLTS, .poll = POLL_FAST),
+PMB_OP(0x8b, .tag = "read_vout", .type = R2, .units = VOLTS,
+		.flags = FLG_FORMAT_VOUT, .poll = POLL_FAST),
+PMB_OP(0x8c, .tag = "read_iout", .type = R2, .units = AMPERES, .poll = POLL_FAST),
+PMB_OP(0x8d, .tag = "read_temperature_1", .type = R2, .units = DEGREES_C, .poll = POLL_SLOW),
+PMB_OP(0x8e, .tag = "read_temperature_2", .type = R2, .units = DEGREES_C, .poll = POLL_SLOW),
+PMB_OP(0x8f, .tag = "read_temperature_3", .type = R2, .units = DEGREES_C, .poll = POLL_SLOW),
+
+PMB_OP(0x90, .tag = "read_fan_speed_1", .type = R2, .poll = POLL_SLOW),
+PMB_OP(0x91, .tag = "read_fan_speed_2", .type = R2, .poll = POLL_SLOW),
+PMB_OP(0x92, .tag = "read_fan_speed_3", .type = R2, .poll = POLL_SLOW),
+PMB_OP(0x93, .tag = "read_fan_speed_4", .type = R2, .poll = POLL_SLOW),
+PMB_OP(0x94, .tag = "read_duty_cycle", .type = R2, .poll = POLL_SLOW),
+PMB_OP(0x95, .tag = "read_frequency", .type = R2, .poll = POLL_SLOW),
+PMB_OP(0x96, .tag = "read_pout", .type = R2, .units = WATTS, .poll = POLL_FAST),
+PMB_OP(0x97, .tag = "read_pin", .type = R2, .units = WATTS, .poll = POLL_FAST),
+PMB_OP(PMB_PMBUS_REVISION, .tag = "pmbus_revision", .type = R1,
+		.flags = FLG_SHOW_P1),
+PMB_OP(PMB_MFR_ID, .tag = "mfr_id", .type = RWB,
+		.units = STRING, .flags = FLG_SHOW_P1),
+PMB_OP(PMB_MFR_MODEL, .tag = "mfr_model", .type = RWB,
+		.units = STRING, .flags = FLG_SHOW_P1),
+PMB_OP(PMB_MFR_REVISION, .tag = "mfr_revision", .type = RWB,
+		.units = STRING, .flags = FLG_SHOW_P1),
+PMB_OP(PMB_MFR_LOCATION, .tag = "mfr_location", .type = RWB,
+		.units = STRING, .flags = FLG_SHOW_P1),
+PMB_OP(PMB_MFR_DATE, .tag = "mfr_date", .type = RWB,
+		.units = STRING, .flags = FLG_SHOW_P1),
+PMB_OP(PMB_MFR_SERIAL, .tag = "mfr_serial", .type = RWB,
+		.units = STRING, .flags = FLG_SHOW_P1),
+PMB_OP(PMB_APP_PROFILES, .tag = "app_profile_support",
+		.type = RWB_APP_PROFILE, .flags = FLG_SHOW_P1),
+
+PMB_OP(0xa0, .tag = "mfr_vin_min", .type = R2, .units = VOLTS),
+PMB_OP(0xa1, .tag = "mfr_vin_max", .type = R2, .units = VOLTS),
+PMB_OP(0xa2, .tag = "mfr_iin_max", .type = R2, .units = AMPERES),
+PMB_OP(0xa3, .tag = "mfr_pin_max", .type = R2, .units = WATTS),
+PMB_OP(0xa4, .tag = "mfr_vout_min", .type = R2, .units = VOLTS),
+PMB_OP(0xa5, .tag = "mfr_vout_max", .type = R2, .units = VOLTS),
+PMB_OP(0xa6, .tag = "mfr_iout_max", .type = R2, .units = AMPERES),
+PMB_OP(0xa7, .tag = "mfr_pout_max", .type = R2, .units = WATTS),
+PMB_OP(0xa8, .tag = "mfr_tambient_max", .type = R2, .units = DEGREES_C),
+PMB_OP(0xa9, .tag = "mfr_tambient_min", .type = R2, .units = DEGREES_C),
+PMB_OP(0xaa, .tag = "mfr_efficiency_ll", .type = RWB14),
+PMB_OP(0xab, .tag = "mfr_efficiency_hl", .type = RWB14),
+PMB_OP(0xac, .tag = "mfr_pin_accuracy", .type = R1),
+PMB_OP(PMB_IC_DEVICE_ID, .tag = "ic_device_id", .type = RWB,
+		.units = STRING, .flags = FLG_SHOW_P1),
+PMB_OP(PMB_IC_DEVICE_REV, .tag = "ic_device_rev", .type = RWB,
+		.units = STRING, .flags = FLG_SHOW_P1),
+
+PMB_OP(PMB_USER_DATA(0),  .tag = "user_data_00", .type = RWB),
+PMB_OP(PMB_USER_DATA(1),  .tag = "user_data_01", .type = RWB),
+PMB_OP(PMB_USER_DATA(2),  .tag = "user_data_02", .type = RWB),
+PMB_OP(PMB_USER_DATA(3),  .tag = "user_data_03", .type = RWB),
+PMB_OP(PMB_USER_DATA(4),  .tag = "user_data_04", .type = RWB),
+PMB_OP(PMB_USER_DATA(5),  .tag = "user_data_05", .type = RWB),
+PMB_OP(PMB_USER_DATA(6),  .tag = "user_data_06", .type = RWB),
+PMB_OP(PMB_USER_DATA(7),  .tag = "user_data_07", .type = RWB),
+PMB_OP(PMB_USER_DATA(8),  .tag = "user_data_08", .type = RWB),
+PMB_OP(PMB_USER_DATA(9),  .tag = "user_data_09", .type = RWB),
+PMB_OP(PMB_USER_DATA(10), .tag = "user_data_10", .type = RWB),
+PMB_OP(PMB_USER_DATA(11), .tag = "user_data_11", .type = RWB),
+PMB_OP(PMB_USER_DATA(12), .tag = "user_data_12", .type = RWB),
+PMB_OP(PMB_USER_DATA(13), .tag = "user_data_13", .type = RWB),
+PMB_OP(PMB_USER_DATA(14), .tag = "user_data_14", .type = RWB),
+PMB_OP(PMB_USER_DATA(15), .tag = "user_data_15", .type = RWB),
+
+PMB_OP(0xc0, .tag = "mfr_max_temp_1", .type = RW2, .units = DEGREES_C),
+PMB_OP(0xc1, .tag = "mfr_max_temp_2", .type = RW2, .units = DEGREES_C),
+PMB_OP(0xc2, .tag = "mfr_max_temp_3", .type = RW2, .units = DEGREES_C),
+
+PMB_OP(PMB_MFR_SPECIFIC(0),  .tag = "mfr_specific_00"),
+PMB_OP(PMB_MFR_SPECIFIC(1),  .tag = "mfr_specific_01"),
+PMB_OP(PMB_MFR_SPECIFIC(2),  .tag = "mfr_specific_02"),
+PMB_OP(PMB_MFR_SPECIFIC(3),  .tag = "mfr_specific_03"),
+PMB_OP(PMB_MFR_SPECIFIC(4),  .tag = "mfr_specific_04"),
+PMB_OP(PMB_MFR_SPECIFIC(5),  .tag = "mfr_specific_05"),
+PMB_OP(PMB_MFR_SPECIFIC(6),  .tag = "mfr_specific_06"),
+PMB_OP(PMB_MFR_SPECIFIC(7),  .tag = "mfr_specific_07"),
+PMB_OP(PMB_MFR_SPECIFIC(8),  .tag = "mfr_specific_08"),
+PMB_OP(PMB_MFR_SPECIFIC(9),  .tag = "mfr_specific_09"),
+PMB_OP(PMB_MFR_SPECIFIC(10), .tag = "mfr_specific_10"),
+PMB_OP(PMB_MFR_SPECIFIC(11), .tag = "mfr_specific_11"),
+PMB_OP(PMB_MFR_SPECIFIC(12), .tag = "mfr_specific_12"),
+PMB_OP(PMB_MFR_SPECIFIC(13), .tag = "mfr_specific_13"),
+PMB_OP(PMB_MFR_SPECIFIC(14), .tag = "mfr_specific_14"),
+PMB_OP(PMB_MFR_SPECIFIC(15), .tag = "mfr_specific_15"),
+
+PMB_OP(PMB_MFR_SPECIFIC(16), .tag = "mfr_specific_16"),
+PMB_OP(PMB_MFR_SPECIFIC(17), .tag = "mfr_specific_17"),
+PMB_OP(PMB_MFR_SPECIFIC(18), .tag = "mfr_specific_18"),
+PMB_OP(PMB_MFR_SPECIFIC(19), .tag = "mfr_specific_19"),
+PMB_OP(PMB_MFR_SPECIFIC(20), .tag = "mfr_specific_20"),
+PMB_OP(PMB_MFR_SPECIFIC(21), .tag = "mfr_specific_21"),
+PMB_OP(PMB_MFR_SPECIFIC(22), .tag = "mfr_specific_22"),
+PMB_OP(PMB_MFR_SPECIFIC(23), .tag = "mfr_specific_23"),
+PMB_OP(PMB_MFR_SPECIFIC(24), .tag = "mfr_specific_24"),
+PMB_OP(PMB_MFR_SPECIFIC(25), .tag = "mfr_specific_25"),
+PMB_OP(PMB_MFR_SPECIFIC(26), .tag = "mfr_specific_26"),
+PMB_OP(PMB_MFR_SPECIFIC(27), .tag = "mfr_specific_27"),
+PMB_OP(PMB_MFR_SPECIFIC(28), .tag = "mfr_specific_28"),
+PMB_OP(PMB_MFR_SPECIFIC(29), .tag = "mfr_specific_29"),
+PMB_OP(PMB_MFR_SPECIFIC(30), .tag = "mfr_specific_30"),
+PMB_OP(PMB_MFR_SPECIFIC(31), .tag = "mfr_specific_31"),
+
+PMB_OP(PMB_MFR_SPECIFIC(32), .tag = "mfr_specific_32"),
+PMB_OP(PMB_MFR_SPECIFIC(33), .tag = "mfr_specific_33"),
+PMB_OP(PMB_MFR_SPECIFIC(34), .tag = "mfr_specific_34"),
+PMB_OP(PMB_MFR_SPECIFIC(35), .tag = "mfr_specific_35"),
+PMB_OP(PMB_MFR_SPECIFIC(36), .tag = "mfr_specific_36"),
+PMB_OP(PMB_MFR_SPECIFIC(37), .tag = "mfr_specific_37"),
+PMB_OP(PMB_MFR_SPECIFIC(38), .tag = "mfr_specific_38"),
+PMB_OP(PMB_MFR_SPECIFIC(39), .tag = "mfr_specific_39"),
+PMB_OP(PMB_MFR_SPECIFIC(40), .tag = "mfr_specific_40"),
+PMB_OP(PMB_MFR_SPECIFIC(41), .tag = "mfr_specific_41"),
+PMB_OP(PMB_MFR_SPECIFIC(42), .tag = "mfr_specific_42"),
+PMB_OP(PMB_MFR_SPECIFIC(43), .tag = "mfr_specific_43"),
+PMB_OP(PMB_MFR_SPECIFIC(44), .tag = "mfr_specific_44"),
+PMB_OP(PMB_MFR_SPECIFIC(45), .tag = "mfr_specific_45"),
+PMB_OP(0xfe, .tag = "mfr_specific_command_ext"),
+PMB_OP(0xff, .tag = "pmbus_command_ext"),
+
 };
 
-static struct pmbus_cmd_desc unsupported = { .tag = "UNSUPPORTED", };
+/* No PMB_MFR_EXT(x) or PMB_EXT(x) commands are described yet */
+static const struct pmbus_cmd_desc pmbus_ext_ops[2][256];
+
+static const struct pmbus_cmd_desc unsupported = { .tag = "UNSUPPORTED", };
+
+#define for_each_pmbus_op(op) \
+	for (op = pmbus_ops; op < pmbus_ops + 256; op++) \
+		if (!op->tag) continue; else
+
+static const struct pmbus_cmd_desc *pmbus_cmd_lookup(u16 cmd)
+{
+	const struct pmbus_cmd_desc *op;
+
+	if (is_pmb_extended(cmd))
+		op = &pmbus_ext_ops[(cmd >> 8) & 1][cmd & 0xff];
+	else if (cmd <= 0xff)
+		op = &pmbus_ops[cmd];
+	else
+		return NULL;
+	return op->tag ? op : NULL;
+}
 
 /*----------------------------------------------------------------------*/
 
+struct pmbus_transport;
+
+/* VOUT_MODE, as last read for some page */
+struct pmbus_vout {
+	u8			valid;
+	u8			mode;
+	s8			exponent;	/* LINEAR16:  N */
+	double			scale;		/* LINEAR16:  2 ^ N */
+};
+
 struct pmbus_dev {
+	const struct pmbus_transport *xport;
+	void			*xport_data;	/* transport private */
 	int			fd;
 	unsigned long		funcs;
 	char			*bus;
@@ -479,1487 +563,6093 @@ struct pmbus_dev {
 	u8			revision;
 	u8			capability;
 	u8			no_query;
+	u8			want_pec;	/* and the adapter can */
 	u8			use_pec;
-	struct pmbus_cmd_desc	*op[256];
+	u8			no_recv_len;	/* adapter balked at it */
+	u8			rdwr_addr;	/* addr in each message */
+	u8			shared;		/* fd etc are another's */
+	u8			force;		/* a driver may use it too */
+	u8			block_len[256];	/* as last advertised; 0 = ? */
+	u8			learned;	/* op[] changed since loading */
+	int			page;		/* as last written; negative = ? */
+	u64			xfer_start_ns;	/* last transfer, per */
+	u64			xfer_end_ns;	/* ... CLOCK_MONOTONIC */
+	u64			holdoff_ns;	/* no transfers before this */
+	struct pmbus_vout	vout[256];	/* per page */
+	char			*ident[4];	/* see pmbus_ident_cmds[] */
+	const struct pmbus_cmd_desc *op[256];
+	struct pmbus_cmd_state	state[256];
 };
 
 static int verbose;
 static int enable_pec;
+static int milli;
+static int use_lut;
+static int batch_query;
+static int use_cache = 1;
+static const char *profile_path;
 
 /*----------------------------------------------------------------------*/
 
 /*
- * The only userspace code for SMBus ops I found comes with a libsensors
- * package that clobbers <linux/i2c-dev.h> on install.  And what we need
- * is PMBus ops anyway... hence this code, which understands some of the
- * ways that PMBus differs from SMBus.
- *
- * Use of 2-byte commands is rejected, but comments show how it could
- * be implemented with reasonable portability.
- *
- * REVISIT return values handling ... "errno" seems to be meaningless
- * since it's almost always EPERM (1), sigh.
+ * SMBus Packet Error Checking:  CRC-8, polynomial x^8 + x^2 + x + 1,
+ * covering every byte of the transaction including the address bytes.
+ * The kernel only does this for I2C_SMBUS calls; for I2C_RDWR messages
+ * it's our job.
  */
+static const u8 crc8_table[256] = {
+	0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15,
+	0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d,
+	0x70, 0x77, 0x7e, 0x79, 0x6c, 0x6b, 0x62, 0x65,
+	0x48, 0x4f, 0x46, 0x41, 0x54, 0x53, 0x5a, 0x5d,
+	0xe0, 0xe7, 0xee, 0xe9, 0xfc, 0xfb, 0xf2, 0xf5,
+	0xd8, 0xdf, 0xd6, 0xd1, 0xc4, 0xc3, 0xca, 0xcd,
+	0x90, 0x97, 0x9e, 0x99, 0x8c, 0x8b, 0x82, 0x85,
+	0xa8, 0xaf, 0xa6, 0xa1, 0xb4, 0xb3, 0xba, 0xbd,
+	0xc7, 0xc0, 0xc9, 0xce, 0xdb, 0xdc, 0xd5, 0xd2,
+	0xff, 0xf8, 0xf1, 0xf6, 0xe3, 0xe4, 0xed, 0xea,
+	0xb7, 0xb0, 0xb9, 0xbe, 0xab, 0xac, 0xa5, 0xa2,
+	0x8f, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9d, 0x9a,
+	0x27, 0x20, 0x29, 0x2e, 0x3b, 0x3c, 0x35, 0x32,
+	0x1f, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0d, 0x0a,
+	0x57, 0x50, 0x59, 0x5e, 0x4b, 0x4c, 0x45, 0x42,
+	0x6f, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7d, 0x7a,
+	0x89, 0x8e, 0x87, 0x80, 0x95, 0x92, 0x9b, 0x9c,
+	0xb1, 0xb6, 0xbf, 0xb8, 0xad, 0xaa, 0xa3, 0xa4,
+	0xf9, 0xfe, 0xf7, 0xf0, 0xe5, 0xe2, 0xeb, 0xec,
+	0xc1, 0xc6, 0xcf, 0xc8, 0xdd, 0xda, 0xd3, 0xd4,
+	0x69, 0x6e, 0x67, 0x60, 0x75, 0x72, 0x7b, 0x7c,
+	0x51, 0x56, 0x5f, 0x58, 0x4d, 0x4a, 0x43, 0x44,
+	0x19, 0x1e, 0x17, 0x10, 0x05, 0x02, 0x0b, 0x0c,
+	0x21, 0x26, 0x2f, 0x28, 0x3d, 0x3a, 0x33, 0x34,
+	0x4e, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5c, 0x5b,
+	0x76, 0x71, 0x78, 0x7f, 0x6a, 0x6d, 0x64, 0x63,
+	0x3e, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2c, 0x2b,
+	0x06, 0x01, 0x08, 0x0f, 0x1a, 0x1d, 0x14, 0x13,
+	0xae, 0xa9, 0xa0, 0xa7, 0xb2, 0xb5, 0xbc, 0xbb,
+	0x96, 0x91, 0x98, 0x9f, 0x8a, 0x8d, 0x84, 0x83,
+	0xde, 0xd9, 0xd0, 0xd7, 0xc2, 0xc5, 0xcc, 0xcb,
+	0xe6, 0xe1, 0xe8, 0xef, 0xfa, 0xfd, 0xf4, 0xf3,
+};
 
-/* Send a bit to the device, if it's present. */
-static inline int smbus_quick(int fd, int flag)
+static u8 pmbus_crc8(u8 crc, const u8 *buf, unsigned len)
 {
-	struct i2c_smbus_ioctl_data	arg;
-
-	memset(&arg, 0, sizeof arg);
-	arg.read_write = flag ? I2C_SMBUS_READ : I2C_SMBUS_WRITE;
-	/* no command */
-	arg.size = I2C_SMBUS_QUICK;
-	/* no data */
+	while (len--)
+		crc = crc8_table[crc ^ *buf++];
+	return crc;
+}
 
-	if (ioctl(fd, I2C_SMBUS, &arg) < 0)
-		return -errno;
-	return 0;
+/* PEC for a write (command and data) optionally followed by a repeated
+ * START and a read; rlen is zero for plain writes.
+ */
+static u8 pmbus_pec(u8 addr, const u8 *wbuf, unsigned wlen,
+		const u8 *rbuf, unsigned rlen)
+{
+	u8 a = addr << 1;
+	u8 crc;
+
+	crc = pmbus_crc8(0, &a, 1);
+	crc = pmbus_crc8(crc, wbuf, wlen);
+	if (rlen) {
+		a |= 1;
+		crc = pmbus_crc8(crc, &a, 1);
+		crc = pmbus_crc8(crc, rbuf, rlen);
+	}
+	return crc;
 }
 
 /*----------------------------------------------------------------------*/
 
 /*
- * READ operations
+ * Every bus access goes through a transport.  The calls mirror the
+ * I2C_SMBUS, I2C_RDWR and I2C_PEC ioctls of i2c-dev, so the protocol
+ * code below doesn't care whether it's talking to a real adapter or
+ * to something that only looks like one.  Everything returns zero (or
+ * the ioctl's non-negative result) on success, else negative errno.
  */
+struct pmbus_transport {
+	const char	*name;
+
+	/* open the bus, fill in pmdev->funcs */
+	int		(*open)(struct pmbus_dev *pmdev, const char *bus);
+	/* bind the handle to one slave address */
+	int		(*set_addr)(struct pmbus_dev *pmdev, u8 addr, bool force);
+	void		(*close)(struct pmbus_dev *pmdev);
+
+	int		(*smbus)(struct pmbus_dev *pmdev,
+				struct i2c_smbus_ioctl_data *arg);
+	int		(*rdwr)(struct pmbus_dev *pmdev,
+				struct i2c_rdwr_ioctl_data *msgdat);
+	int		(*pec)(struct pmbus_dev *pmdev, bool enable);
+};
 
-/* Returns a byte, or negative errno. */
-static int pmbus_read_byte_data(int fd, u16 cmd)
+static inline u64 pmbus_now_ns(void)
 {
-	struct i2c_smbus_ioctl_data	arg;
-	u8				byte;
-
-	/* use i2c; or READ_I2C_BLOCK_2: 2 byte cmd, 1 byte block */
-	if (is_pmb_extended(cmd))
-		return -ENOSYS;
-
-	if (!is_pmb_8bit(cmd))
-		return -EINVAL;
-
-	memset(&arg, 0, sizeof arg);
-	arg.read_write = I2C_SMBUS_READ;
-	arg.command = cmd;
-	arg.size = I2C_SMBUS_BYTE_DATA;
-	arg.data = (union i2c_smbus_data *) &byte;
-
-	if (ioctl(fd, I2C_SMBUS, &arg) < 0)
-		return -errno;
+	struct timespec ts;
 
-	return byte;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-/* Returns a word, or negative errno. */
-static int pmbus_read_word_data(int fd, u16 cmd)
+static inline void pmbus_ns_to_timespec(u64 ns, struct timespec *ts)
 {
-	struct i2c_smbus_ioctl_data	arg;
-	u16				word;
-
-	/* use i2c; or READ_I2C_BLOCK_2: 2 byte cmd, 2 byte block */
-	if (is_pmb_extended(cmd))
-		return -ENOSYS;
-
-	if (!is_pmb_8bit(cmd))
-		return -EINVAL;
-
-	memset(&arg, 0, sizeof arg);
-	arg.read_write = I2C_SMBUS_READ;
-	arg.command = cmd;
-	arg.size = I2C_SMBUS_WORD_DATA;
-	arg.data = (union i2c_smbus_data *) &word;
-
-	if (ioctl(fd, I2C_SMBUS, &arg) < 0)
-		return -errno;
-
-	/* adapter code handled byteswapping if needed */
-	return word;
+	ts->tv_sec = ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
 }
 
-static int pmbus_read_block_without_checking(struct pmbus_dev *pmdev, u16 cmd,
-		unsigned read_len, int advertised_len, u8 *read_buf)
+/* Keep the bus quiet for a while, e.g. to let a slow device recover.
+ * Unlike a plain usleep(), only the next transfer waits, and only for
+ * whatever time hasn't passed already.
+ */
+static void pmbus_xfer_holdoff(struct pmbus_dev *pmdev, unsigned usec)
 {
-	struct i2c_smbus_ioctl_data	arg;
-	union i2c_smbus_data		data;
-	int				retval;
+	pmdev->holdoff_ns = pmbus_now_ns() + usec * 1000ULL;
+}
 
-	if (!read_buf || read_len == 0)
-		return -EINVAL;
+/* Transfers are timestamped right around the call, for telemetry */
+static inline void pmbus_xfer_begin(struct pmbus_dev *pmdev)
+{
+	struct timespec ts;
 
-	/* use i2c; or READ_I2C_BLOCK_2: 2 byte cmd, N byte block */
-	if (is_pmb_extended(cmd))
-		return -ENOSYS;
+	if (pmdev->holdoff_ns) {
+		pmbus_ns_to_timespec(pmdev->holdoff_ns, &ts);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&ts, NULL) == EINTR)
+			continue;
+		pmdev->holdoff_ns = 0;
+	}
+	pmdev->xfer_start_ns = pmbus_now_ns();
+}
 
-	if (!is_pmb_8bit(cmd))
-		return -EINVAL;
+/*
+ * SMBus transactions sent as I2C messages, for adapters that can do I2C.
+ * Each message carries the slave address, so the bus handle needn't be
+ * bound to one device with I2C_SLAVE; one handle can serve every device
+ * on the bus.  PEC is done here, since the kernel only does it for SMBus
+ * calls.  Lone reads (quick read, receive byte) aren't used with PMBus.
+ */
+static int pmbus_smbus_rdwr(struct pmbus_dev *pmdev,
+		struct i2c_smbus_ioctl_data *arg)
+{
+	union i2c_smbus_data		*data = arg->data;
+	struct i2c_msg			msg[2];
+	struct i2c_rdwr_ioctl_data	msgdat;
+	u8				w[2 + I2C_SMBUS_BLOCK_MAX + 1];
+	u8				r[1 + I2C_SMBUS_BLOCK_MAX + 1];
+	unsigned			wlen = 1, rlen = 0;
+	bool				rd = arg->read_write == I2C_SMBUS_READ;
+	bool				recv_len = 0;
+	int				status;
 
-	if (advertised_len > I2C_SMBUS_BLOCK_MAX) {
-		retval = -EFBIG;
-		goto try_i2c;
+	w[0] = arg->command;
+	switch (arg->size) {
+	case I2C_SMBUS_QUICK:
+		if (rd)
+			return -EOPNOTSUPP;
+		wlen = 0;
+		break;
+	case I2C_SMBUS_BYTE:
+		if (rd)
+			return -EOPNOTSUPP;
+		break;
+	case I2C_SMBUS_BYTE_DATA:
+		if (rd)
+			rlen = 1;
+		else
+			w[wlen++] = data->byte;
+		break;
+	case I2C_SMBUS_WORD_DATA:
+		if (rd) {
+			rlen = 2;
+			break;
+		}
+		/* FALLTHROUGH */
+	case I2C_SMBUS_PROC_CALL:
+		w[wlen++] = data->word;
+		w[wlen++] = data->word >> 8;
+		if (arg->size == I2C_SMBUS_PROC_CALL)
+			rlen = 2;
+		break;
+	case I2C_SMBUS_BLOCK_DATA:
+		if (rd) {
+			recv_len = 1;
+			break;
+		}
+		/* FALLTHROUGH */
+	case I2C_SMBUS_BLOCK_PROC_CALL:
+		if (data->block[0] > I2C_SMBUS_BLOCK_MAX)
+			return -EINVAL;
+		memcpy(w + 1, data->block, data->block[0] + 1);
+		wlen += data->block[0] + 1;
+		if (arg->size == I2C_SMBUS_BLOCK_PROC_CALL)
+			recv_len = 1;
+		break;
+	default:
+		return -EOPNOTSUPP;
 	}
-
-	/* If there's no SMBus support, I2C will work (we checked).
-	 * Or, we might use "I2C block read" for up to 31 data bytes.
-	 */
-	if (!(pmdev->funcs & I2C_FUNC_SMBUS_READ_BLOCK_DATA)) {
-		retval = -EOPNOTSUPP;
-		goto try_i2c;
+	if (recv_len && pmdev->no_recv_len)
+		return -EOPNOTSUPP;
+
+	msgdat.msgs = msg;
+	msgdat.nmsgs = 1;
+
+	msg[0].addr = pmdev->addr;
+	msg[0].flags = 0;
+	msg[0].len = wlen;
+	msg[0].buf = w;
+	if (!rlen && !recv_len) {
+		if (pmdev->use_pec && wlen)
+			w[msg[0].len++] = pmbus_pec(pmdev->addr,
+					w, wlen, NULL, 0);
+	} else {
+		msgdat.nmsgs = 2;
+		msg[1].addr = pmdev->addr;
+		msg[1].buf = r;
+		if (recv_len) {
+			/* as in pmbus_read_block_recv_len() */
+			r[0] = pmdev->use_pec ? 2 : 1;
+			msg[1].flags = I2C_M_RD | I2C_M_RECV_LEN;
+			msg[1].len = sizeof r;
+		} else {
+			msg[1].flags = I2C_M_RD;
+			msg[1].len = rlen + !!pmdev->use_pec;
+		}
 	}
 
-	memset(&arg, 0, sizeof arg);
-	arg.read_write = I2C_SMBUS_READ;
-	arg.command = cmd;
-	arg.size = I2C_SMBUS_BLOCK_DATA;
-	arg.data = &data;
+	status = pmdev->xport->rdwr(pmdev, &msgdat);
+	if (recv_len && (status == -EINVAL || status == -EOPNOTSUPP))
+		pmdev->no_recv_len = 1;
+	if (status < 0 || msgdat.nmsgs == 1)
+		return (status < 0) ? status : 0;
 
-	/* When this fails, we can't really know why.  In case it's the
-	 * SMBus code saying "block too big", try again (if possible).
-	 */
-	if (ioctl(pmdev->fd, I2C_SMBUS, &arg) < 0) {
-		retval = -errno;
-		goto try_i2c;
+	if (recv_len) {
+		if (r[0] > I2C_SMBUS_BLOCK_MAX)
+			return -EPROTO;
+		rlen = r[0] + 1;
 	}
+	if (pmdev->use_pec && pmbus_pec(pmdev->addr, w, wlen, r, rlen)
+			!= r[rlen])
+		return -EBADMSG;
+
+	if (recv_len)
+		memcpy(data->block, r, rlen);
+	else if (rlen == 1)
+		data->byte = r[0];
+	else
+		data->word = r[0] | (r[1] << 8);
+	return 0;
+}
 
-	if (data.block[0] <= read_len) {
-		if (data.block[0] > 32) {
-			/* NOTE:  this probably won't be visible */
-			retval = -EFBIG;
-			goto try_i2c;
-		}
-		retval = read_len = data.block[0];
-	} else
-		retval = -E2BIG;
-	memcpy(read_buf, &data.block[1], read_len);
+static inline int pmbus_xfer_smbus(struct pmbus_dev *pmdev,
+		struct i2c_smbus_ioctl_data *arg)
+{
+	int status;
 
-	return retval;
+	pmbus_xfer_begin(pmdev);
+	if (pmdev->rdwr_addr)
+		status = pmbus_smbus_rdwr(pmdev, arg);
+	else
+		status = pmdev->xport->smbus(pmdev, arg);
+	pmdev->xfer_end_ns = pmbus_now_ns();
+	return status;
+}
 
-try_i2c:
-	/* NOTE: no PEC here, but it *could* be done here in userspace */
-	if (pmdev->funcs & I2C_FUNC_I2C) {
-		struct i2c_msg			msg[2];
-		struct i2c_rdwr_ioctl_data	msgdat;
-		u8				buf[256];
+static inline int pmbus_xfer_rdwr(struct pmbus_dev *pmdev,
+		struct i2c_rdwr_ioctl_data *msgdat)
+{
+	int status;
 
-		msgdat.msgs = msg;
-		msgdat.nmsgs = 2;
+	pmbus_xfer_begin(pmdev);
+	status = pmdev->xport->rdwr(pmdev, msgdat);
+	pmdev->xfer_end_ns = pmbus_now_ns();
+	return status;
+}
 
-		msg[0].addr = msg[1].addr = pmdev->addr;
+/* When the last transfer most likely sampled its data */
+static inline u64 pmbus_xfer_time_ns(const struct pmbus_dev *pmdev)
+{
+	return pmdev->xfer_start_ns
+		+ (pmdev->xfer_end_ns - pmdev->xfer_start_ns) / 2;
+}
 
-		buf[0] = cmd & 0x0ff;
+static inline int pmbus_xfer_pec(struct pmbus_dev *pmdev, bool enable)
+{
+	return pmdev->xport->pec(pmdev, enable);
+}
 
-		msg[0].flags = 0;
-		msg[0].len = 1;
-		msg[0].buf = buf;
+/* i2c-dev:  the real thing, /dev/i2c-N */
 
-		msg[1].flags = I2C_M_RD;
-		msg[1].len = advertised_len + 1;
-		msg[1].buf = buf;
+static int i2cdev_open(struct pmbus_dev *pmdev, const char *bus)
+{
+	int status;
 
-		if (ioctl(pmdev->fd, I2C_RDWR, &msgdat) < 0)
-			return -errno;
+	pmdev->fd = open(bus, O_RDWR);
+	if (pmdev->fd < 0)
+		return -errno;
 
-		if (buf[0] <= read_len)
-			retval = read_len = buf[0];
-		else
-			retval = -E2BIG;
-		memcpy(read_buf, &buf[1], read_len);
+	if (ioctl(pmdev->fd, I2C_FUNCS, &pmdev->funcs) < 0) {
+		status = -errno;
+		close(pmdev->fd);
+		pmdev->fd = -1;
+		return status;
 	}
-
-	return retval;
+	return 0;
 }
 
-/* Returns the number of bytes copied into read_buf, or negative errno.
- * If the block is bigger than read_len, read_len is copied and -E2BIG
- * is returned (so the caller can recover, somewhat).
- */
-static int pmbus_read_block(struct pmbus_dev *pmdev, u16 cmd,
-		unsigned read_len, u8 *read_buf)
+static int i2cdev_set_addr(struct pmbus_dev *pmdev, u8 addr, bool force)
 {
-	struct i2c_smbus_ioctl_data	arg;
-	union i2c_smbus_data		data;
-	int				retval;
-	int				len;
+	if (ioctl(pmdev->fd, force ? I2C_SLAVE_FORCE : I2C_SLAVE, addr) < 0)
+		return -errno;
+	return 0;
+}
 
-	if (!read_buf || read_len == 0)
-		return -EINVAL;
+static void i2cdev_close(struct pmbus_dev *pmdev)
+{
+	if (pmdev->fd >= 0)
+		close(pmdev->fd);
+	pmdev->fd = -1;
+}
 
-	/* use i2c; or READ_I2C_BLOCK_2: 2 byte cmd, N byte block */
-	if (is_pmb_extended(cmd))
-		return -ENOSYS;
+static int i2cdev_smbus(struct pmbus_dev *pmdev,
+		struct i2c_smbus_ioctl_data *arg)
+{
+	if (ioctl(pmdev->fd, I2C_SMBUS, arg) < 0)
+		return -errno;
+	return 0;
+}
 
-	if (!is_pmb_8bit(cmd))
-		return -EINVAL;
+static int i2cdev_rdwr(struct pmbus_dev *pmdev,
+		struct i2c_rdwr_ioctl_data *msgdat)
+{
+	int status;
 
-	/* Handle "large" blocks sanely by issuing an extra read to
-	 * prevent one fault-path traversal (e.g. SMBALERT#) when the
-	 * block is bigger than the morsel allowed by SMBus.
-	 * As we are only reading a part of the packet from the slave,
-	 * we have to temporarily disable PEC.
-	 */
-	if (pmdev->use_pec) {
-		if (ioctl(pmdev->fd, I2C_PEC, 0)) {
-			fprintf(stderr, "Cannot temporarily disable PEC");
-		}
-	}
-	len = pmbus_read_byte_data(pmdev->fd, cmd);
-	if (len < 0)
-		return len;
-	if (pmdev->use_pec) {
-		if (ioctl(pmdev->fd, I2C_PEC, 1)) {
-			fprintf(stderr, "Cannot re-enable PEC");
-		}
-	}
+	status = ioctl(pmdev->fd, I2C_RDWR, msgdat);
+	return (status < 0) ? -errno : status;
+}
 
-	return pmbus_read_block_without_checking(pmdev, cmd, read_len, len, read_buf);
+static int i2cdev_pec(struct pmbus_dev *pmdev, bool enable)
+{
+	if (ioctl(pmdev->fd, I2C_PEC, enable ? 1 : 0) < 0)
+		return -errno;
+	return 0;
 }
 
+static const struct pmbus_transport i2cdev_transport = {
+	.name		= "i2c-dev",
+	.open		= i2cdev_open,
+	.set_addr	= i2cdev_set_addr,
+	.close		= i2cdev_close,
+	.smbus		= i2cdev_smbus,
+	.rdwr		= i2cdev_rdwr,
+	.pec		= i2cdev_pec,
+};
+
 /*----------------------------------------------------------------------*/
 
 /*
- * WRITE operations
+ * Simulated PMBus slave, selected with "-b sim[:option,...]".  It answers
+ * QUERY, COEFFICIENTS, VOUT_MODE, the STATUS_* registers, inventory strings
+ * and the READ_* telemetry, so the scan and show paths can be exercised
+ * (and timed) without hardware.  Options, comma separated:
+ *
+ *   addr=0x58		address the slave answers at
+ *   format=linear	LINEAR11 telemetry, LINEAR16 VOUT (default)
+ *   format=direct	DIRECT telemetry, with COEFFICIENTS
+ *   vout=direct	DIRECT (not LINEAR16) VOUT, per VOUT_MODE
+ *   pages=N		number of PAGEs (output rails)
+ *   rev=1.0		PMBus 1.0 device:  no QUERY or COEFFICIENTS
+ *   latency=USEC	fixed cost of each bus transfer (one ioctl)
+ *   khz=N		bus clock, adds per-byte wire time; 0 = none
+ *   nack=PCT		percentage of transactions to NACK
+ *   stretch=PCT:USEC	percentage of transactions to clock stretch
+ *   seed=N		seed for NACK and stretch injection
+ *   funcs=0xN		adapter functionality mask to advertise
+ *
+ * With "-v", transfer statistics are reported when the bus is closed.
  */
 
-/* This is ONLY to temporarily shut up some gcc warnings; most
- * of the write-side infrastructure is not yet used here.
- */
-#define SHADDAP	inline
+#define SIM_MAX_PAGES	8
+
+struct sim_dev {
+	u8			addr;		/* as bound by set_addr */
+	u8			slave;		/* address we answer at */
+	u8			direct;
+	u8			vout_direct;
+	u8			rev10;
+	u8			pages;
+	u8			page;
+
+	unsigned		latency_us;
+	unsigned		khz;
+	unsigned		nack_pct;
+	unsigned		stretch_pct;
+	unsigned		stretch_us;
+	unsigned		rand;
+
+	/* the device model */
+	u8			query[256];
+	struct pmbus_coefficients c[256];
+	u16			reg[SIM_MAX_PAGES][256];
+	const char		*str[256];
+
+	/* per transfer, reset by sim_begin() */
+	unsigned long		delay_ns;
+
+	/* statistics */
+	unsigned long		xfers;
+	unsigned long		xacts;
+	unsigned long		nacks;
+	unsigned long		stretches;
+	unsigned long		bytes;
+	unsigned long		*lat_ns;
+	size_t			nlat, maxlat;
+};
 
-/* With PMBus, transactions may never start with the "read" bit set.
- * That includes "Quick" messages.  Break that rule and get a CML
- * alert (e.g. SMBALERT#).
- */
-static int pmbus_quick(int fd)
-{
-	return smbus_quick(fd, 0);
-}
+/* Physical values for the numeric commands the simulated device supports */
+static const struct sim_value {
+	u16		cmd;
+	double		value;
+} sim_values[] = {
+	{ 0x21, 12.0, },		/* vout_command */
+	{ 0x24, 13.2, },		/* vout_max */
+	{ 0x25, 12.6, },		/* vout_margin_high */
+	{ 0x26, 11.4, },		/* vout_margin_low */
+	{ 0x3b, 50.0, },		/* fan_command_1 */
+	{ 0x40, 14.0, },		/* vout_ov_fault_limit */
+	{ 0x42, 13.5, },		/* vout_ov_warn_limit */
+	{ 0x43, 10.5, },		/* vout_uv_warn_limit */
+	{ 0x44, 10.0, },		/* vout_uv_fault_limit */
+	{ 0x46, 45.0, },		/* iout_oc_fault_limit */
+	{ 0x4a, 42.0, },		/* iout_oc_warn_limit */
+	{ 0x4f, 110.0, },		/* ot_fault_limit */
+	{ 0x51, 100.0, },		/* ot_warn_limit */
+	{ 0x55, 264.0, },		/* vin_ov_fault_limit */
+	{ 0x57, 260.0, },		/* vin_ov_warn_limit */
+	{ 0x58, 94.0, },		/* vin_uv_warn_limit */
+	{ 0x59, 90.0, },		/* vin_uv_fault_limit */
+	{ 0x60, 10.0, },		/* ton_delay */
+	{ 0x61, 20.0, },		/* ton_rise */
+	{ 0x88, 230.5, },		/* read_vin */
+	{ 0x89, 1.25, },		/* read_iin */
+	{ 0x8b, 12.05, },		/* read_vout */
+	{ 0x8c, 20.5, },		/* read_iout */
+	{ 0x8d, 35.0, },		/* read_temperature_1 */
+	{ 0x8e, 41.5, },		/* read_temperature_2 */
+	{ 0x90, 8000.0, },		/* read_fan_speed_1 */
+	{ 0x96, 246.0, },		/* read_pout */
+	{ 0x97, 270.0, },		/* read_pin */
+	{ 0xa0, 90.0, },		/* mfr_vin_min */
+	{ 0xa1, 264.0, },		/* mfr_vin_max */
+	{ 0xa3, 600.0, },		/* mfr_pin_max */
+	{ 0xa7, 500.0, },		/* mfr_pout_max */
+};
 
-/* Returns zero, or negative errno. */
-static int smbus_write_byte(int fd, u8 byte)
-{
-	struct i2c_smbus_ioctl_data	arg;
+/* ... and the ones that are bitmasks or other raw data */
+static const struct sim_raw {
+	u16		cmd;
+	u16		value;
+} sim_raws[] = {
+	{ 0x00, 0x00, },		/* page */
+	{ 0x01, 0x80, },		/* operation: on */
+	{ 0x02, 0x17, },		/* on_off_config */
+	{ 0x10, 0x00, },		/* write_protect */
+	{ PMB_CAPABILITY, 0xb0, },	/* PEC, 400 KHz, SMBALERT# */
+	{ PMB_VOUT_MODE, 0x17, },	/* LINEAR, exponent -9 */
+	{ 0x3a, 0x90, },		/* fan_config_1_2 */
+	{ PMB_STATUS_BYTE, 0x00, },
+	{ PMB_STATUS_WORD, 0x0000, },
+	{ PMB_STATUS_VOUT, 0x00, },
+	{ PMB_STATUS_IOUT, 0x00, },
+	{ PMB_STATUS_INPUT, 0x00, },
+	{ PMB_STATUS_TEMPERATURE, 0x00, },
+	{ PMB_STATUS_CML, 0x00, },
+	{ PMB_STATUS_OTHER, 0x00, },
+	{ PMB_STATUS_FANS_1_2, 0x00, },
+	{ PMB_PMBUS_REVISION, 0x22, },	/* 1.2, 1.2 */
+};
 
-	memset(&arg, 0, sizeof arg);
-	arg.read_write = I2C_SMBUS_WRITE;
-	arg.command = byte;
-	arg.size = I2C_SMBUS_BYTE;
+static const struct sim_string {
+	u16		cmd;
+	const char	*value;
+} sim_strings[] = {
+	{ PMB_MFR_ID, "pmbus_peek", },
+	{ PMB_MFR_MODEL, "SIM-PSU-500", },
+	{ PMB_MFR_REVISION, "A1", },
+	{ PMB_MFR_LOCATION, "userspace", },
+	{ PMB_MFR_DATE, "080424", },
+	{ PMB_MFR_SERIAL, "SIM0000001", },
+	{ PMB_IC_DEVICE_ID, "PMBSIM", },
+	{ PMB_IC_DEVICE_REV, "1", },
+	{ PMB_APP_PROFILES, "\x01\x10", },	/* Server AC-DC, rev 1.0 */
+};
 
-	if (ioctl(fd, I2C_SMBUS, &arg) < 0)
-		return -errno;
-	return 0;
+/* DIRECT format coefficients, chosen to exercise m, b and both signs of R */
+static void sim_coefficients(struct pmbus_coefficients *c, u8 units)
+{
+	c->valid = 1;
+	switch (units) {
+	case VOLTS:
+		c->m = 1; c->b = 0; c->R = 2;
+		break;
+	case AMPERES:
+		c->m = 1000; c->b = 0; c->R = -1;
+		break;
+	case DEGREES_C:
+		c->m = 2; c->b = 100; c->R = 0;
+		break;
+	case WATTS:
+		c->m = 5; c->b = 0; c->R = 0;
+		break;
+	default:
+		c->m = 1; c->b = 0; c->R = 0;
+		break;
+	}
 }
 
-/* Returns zero, or negative errno. */
-static SHADDAP int pmbus_write_byte_data(int fd, u16 cmd, u8 byte)
+static u16 sim_encode_linear11(double x)
 {
-	struct i2c_smbus_ioctl_data	arg;
-
-	/* use i2c; or WRITE_I2C_BLOCK_2: 2 byte cmd, 1 byte block;
-	 * or tweak params to SMBus "write word"
-	 */
-	if (is_pmb_extended(cmd))
-		return -ENOSYS;
-
-	if (!is_pmb_8bit(cmd))
-		return -EINVAL;
-
-	memset(&arg, 0, sizeof arg);
-	arg.read_write = I2C_SMBUS_WRITE;
-	arg.command = cmd;
-	arg.size = I2C_SMBUS_BYTE_DATA;
-	arg.data = (union i2c_smbus_data *) &byte;
+	int	e, m;
 
-	if (ioctl(fd, I2C_SMBUS, &arg) < 0)
-		return -errno;
-	return 0;
+	for (e = -16; e < 15; e++) {
+		if (fabs(x) / ldexp(1.0, e) < 1023.5)
+			break;
+	}
+	m = (int) lround(x / ldexp(1.0, e));
+	return ((e & 0x1f) << 11) | (m & 0x7ff);
 }
 
-/* Returns zero, or negative errno. */
-static SHADDAP int pmbus_write_word_data(int fd, u16 cmd, u16 word)
+static u16 sim_encode_direct(double x, const struct pmbus_coefficients *c)
 {
-	struct i2c_smbus_ioctl_data	arg;
-
-	/* use i2c; or WRITE_I2C_BLOCK_2: 2 byte cmd, 2 byte block */
-	if (is_pmb_extended(cmd))
-		return -ENOSYS;
+	double	y = c->m * x + c->b;
+	int	r;
+
+	/* Y = (mX + b) * 10^R */
+	for (r = c->R; r > 0; r--)
+		y *= 10.0;
+	for (r = c->R; r < 0; r++)
+		y /= 10.0;
+	return (u16) (s16) lround(y);
+}
 
-	if (!is_pmb_8bit(cmd))
-		return -EINVAL;
+static u16 sim_encode(struct sim_dev *sim, const struct pmbus_cmd_desc *op,
+		double x)
+{
+	/* VOUT_MODE says LINEAR, exponent -9; or DIRECT */
+	if (op->flags & FLG_FORMAT_VOUT) {
+		if (!sim->vout_direct)
+			return (u16) lround(x * 512.0);
+		return sim_encode_direct(x, &sim->c[op->cmd]);
+	}
+	if (sim->direct)
+		return sim_encode_direct(x, &sim->c[op->cmd]);
+	return sim_encode_linear11(x);
+}
 
-	/* adapter code handles byteswapping if needed */
-	memset(&arg, 0, sizeof arg);
-	arg.read_write = I2C_SMBUS_WRITE;
-	arg.command = cmd;
-	arg.size = I2C_SMBUS_WORD_DATA;
-	arg.data = (union i2c_smbus_data *) &word;
+/* Mark a command as supported, with QUERY data matching its syntax */
+static void sim_support(struct sim_dev *sim, u16 cmd, u8 format)
+{
+	const struct pmbus_cmd_desc *op = pmbus_cmd_lookup(cmd);
+	u8 query = (1 << 7) | (format << 2);
 
-	if (ioctl(fd, I2C_SMBUS, &arg) < 0)
-		return -errno;
-	return 0;
+	if (!op)
+		return;
+	switch (op->type) {
+	case RW1:
+	case RW2:
+	case RWB:
+	case RWB14:
+		query |= (1 << 6) | (1 << 5);
+		break;
+	case W0:
+	case W1:
+		query |= (1 << 6);
+		break;
+	default:
+		query |= (1 << 5);
+		break;
+	}
+	sim->query[cmd] = query;
 }
 
-/* Returns zero, or negative errno. */
-static SHADDAP int pmbus_write_block(struct pmbus_dev *pmdev, u16 cmd,
-		unsigned write_len, u8 *write_buf)
+static void sim_init(struct sim_dev *sim)
 {
-	struct i2c_smbus_ioctl_data	arg;
-	union i2c_smbus_data		data;
-	int				retval;
-
-	if (!write_buf || write_len == 0 || write_len > 255)
-		return -EINVAL;
+	unsigned	i, page;
 
-	/* use i2c; or WRITE_I2C_BLOCK_2: 2 byte cmd, N byte block */
-	if (is_pmb_extended(cmd))
-		return -ENOSYS;
+	sim_support(sim, PMB_QUERY, 7);
+	sim_support(sim, PMB_CLEAR_FAULT, 7);
+	if (sim->direct)
+		sim_support(sim, PMB_COEFFICIENTS, 7);
 
-	if (!is_pmb_8bit(cmd))
-		return -EINVAL;
+	for (i = 0; i < sizeof sim_raws / sizeof sim_raws[0]; i++) {
+		const struct sim_raw *r = &sim_raws[i];
 
-	/* If there's no SMBus support, I2C might work (we did NOT ensure
-	 * there will be one or the other)
-	 */
-	if (!(pmdev->funcs & I2C_FUNC_SMBUS_WRITE_BLOCK_DATA)) {
-		retval = -EOPNOTSUPP;
-		goto try_i2c;
-	}
-	if (write_len > 32) {
-		retval = -EFBIG;
-		goto try_i2c;
+		/* STATUS_WORD is "numeric", decoded as a bitmask */
+		sim_support(sim, r->cmd, r->cmd == PMB_STATUS_WORD ? 0 : 7);
+		for (page = 0; page < SIM_MAX_PAGES; page++)
+			sim->reg[page][r->cmd] = r->value;
 	}
 
-	data.block[0] = write_len;
-	memcpy(&data.block[1], write_buf, write_len);
-
-	memset(&arg, 0, sizeof arg);
-	arg.read_write = I2C_SMBUS_WRITE;
-	arg.command = cmd;
-	arg.size = I2C_SMBUS_BLOCK_DATA;
-	arg.data = &data;
-
-	if (ioctl(pmdev->fd, I2C_SMBUS, &arg) < 0)
-		return -errno;
-	return 0;
+	for (i = 0; i < sizeof sim_strings / sizeof sim_strings[0]; i++) {
+		sim_support(sim, sim_strings[i].cmd, 7);
+		sim->str[sim_strings[i].cmd] = sim_strings[i].value;
+	}
 
-try_i2c:
-	/* NOTE: no PEC here, but it *could* be done here in userspace */
-	if (pmdev->funcs & I2C_FUNC_I2C) {
-		struct i2c_msg			msg;
-		struct i2c_rdwr_ioctl_data	msgdat;
-		u8				buf[257];
+	for (i = 0; i < sizeof sim_values / sizeof sim_values[0]; i++) {
+		const struct sim_value *v = &sim_values[i];
+		const struct pmbus_cmd_desc *op = pmbus_cmd_lookup(v->cmd);
 
-		msgdat.msgs = &msg;
-		msgdat.nmsgs = 1;
+		if (!op)
+			continue;
+		if ((op->flags & FLG_FORMAT_VOUT)
+				? sim->vout_direct : sim->direct) {
+			sim_coefficients(&sim->c[v->cmd], op->units);
+			sim_support(sim, v->cmd, 3);
+		} else
+			sim_support(sim, v->cmd, 0);
 
-		msg.addr = pmdev->addr;
-		msg.flags = 0;
-		msg.len = 2 + write_len;
-		msg.buf = buf;
+		/* each extra rail is a bit weaker than the one before */
+		for (page = 0; page < SIM_MAX_PAGES; page++)
+			sim->reg[page][v->cmd] = sim_encode(sim, op,
+					v->value * (1.0 - 0.1 * page));
+	}
 
-		buf[0] = cmd;
-		buf[1] = write_len;
-		memcpy(&buf[2], write_buf, write_len);
+	/* energy counter:  accumulator, rollover count, sample count */
+	sim_support(sim, 0x86, sim->direct ? 3 : 0);
+	sim_coefficients(&sim->c[0x86], 0);
 
-		retval = (ioctl(pmdev->fd, I2C_RDWR, &msgdat) < 0)
-				? -errno : 0;
+	if (sim->vout_direct) {
+		sim_support(sim, PMB_COEFFICIENTS, 7);
+		for (page = 0; page < SIM_MAX_PAGES; page++)
+			sim->reg[page][PMB_VOUT_MODE] = 0x40;
 	}
 
-	return retval;
+	/* the part still knows its formats; it just can't tell anyone */
+	if (sim->rev10) {
+		sim->query[PMB_QUERY] = 0;
+		sim->query[PMB_COEFFICIENTS] = 0;
+		for (page = 0; page < SIM_MAX_PAGES; page++)
+			sim->reg[page][PMB_PMBUS_REVISION] = 0x00;
+	}
 }
 
-/*----------------------------------------------------------------------*/
-
-static void
-coefficients(struct pmbus_dev *pmdev, struct pmbus_cmd_desc *op, int read)
+static unsigned sim_random(struct sim_dev *sim)
 {
-	union i2c_smbus_data		data;
-	int				status;
-	struct pmbus_coefficients	*c;
-
-	read = !!read;
-	c = op->c + read;
+	/* xorshift32; good enough for fault injection */
+	sim->rand ^= sim->rand << 13;
+	sim->rand ^= sim->rand >> 17;
+	sim->rand ^= sim->rand << 5;
+	return sim->rand;
+}
 
-	/* This is specified as a block proc call, which is currently not
-	 * widely supported.  The I2C-level backup makes sure that many
-	 * more systems can use this call.
-	 *
-	 * NOTE as with QUERY, handling for "extended" commands is not
-	 * specified by PMBus 1.1 ...
-	 */
-	if (pmdev->funcs & I2C_FUNC_SMBUS_BLOCK_PROC_CALL) {
-		struct i2c_smbus_ioctl_data	arg;
+static void sim_cml(struct sim_dev *sim, u8 bit)
+{
+	sim->reg[sim->page][PMB_STATUS_CML] |= bit;
+	sim->reg[sim->page][PMB_STATUS_BYTE] |= (1 << 1);
+	sim->reg[sim->page][PMB_STATUS_WORD] |= (1 << 1);
+}
 
-		data.block[0] = 2;
-		data.block[1] = op->cmd;
-		data.block[2] = read;
+/* Build the slave's response to a read of "cmd", given any data the
+ * master wrote first (process calls).  Returns the response length,
+ * or negative errno if the slave would NACK.
+ */
+static int sim_respond(struct sim_dev *sim, u8 cmd,
+		const u8 *wdata, unsigned wlen, u8 *resp)
+{
+	const struct pmbus_cmd_desc	*op;
+	u16				value;
+	unsigned			len;
 
-		memset(&arg, 0, sizeof arg);
-		arg.read_write = I2C_SMBUS_WRITE;
-		arg.command = PMB_COEFFICIENTS;
-		arg.size = I2C_SMBUS_BLOCK_PROC_CALL;
-		arg.data = &data;
+	if (!(sim->query[cmd] & (1 << 5))) {
+		sim_cml(sim, 1 << 7);
+		return -EREMOTEIO;
+	}
 
-		status = ioctl(pmdev->fd, I2C_SMBUS, &arg);
+	value = sim->reg[sim->page][cmd];
+	switch (cmd) {
+	case PMB_QUERY:
+		if (wlen < 2 || wdata[0] != 1)
+			break;
+		resp[0] = 1;
+		resp[1] = sim->query[wdata[1]];
+		return 2;
+	case PMB_COEFFICIENTS: {
+		const struct pmbus_coefficients *c;
 
-	/* NOTE: no PEC here, but it *could* be done here in userspace */
-	} else if (pmdev->funcs & I2C_FUNC_I2C) {
-		struct i2c_msg			msg[2];
-		struct i2c_rdwr_ioctl_data	msgdat;
+		if (wlen < 3 || wdata[0] != 2)
+			break;
+		c = &sim->c[wdata[1]];
+		if (!c->valid)
+			break;
+		resp[0] = 5;
+		resp[1] = c->m;
+		resp[2] = c->m >> 8;
+		resp[3] = c->b;
+		resp[4] = c->b >> 8;
+		resp[5] = c->R;
+		return 6;
+		}
+	case 0x86:
+		resp[0] = 6;
+		resp[1] = 0x34;		/* accumulator */
+		resp[2] = 0x12;
+		resp[3] = 2;		/* rollovers */
+		resp[4] = 0x00;		/* samples */
+		resp[5] = 0x04;
+		resp[6] = 0x00;
+		return 7;
+	}
 
-		msgdat.msgs = msg;
-		msgdat.nmsgs = 2;
+	if (sim->str[cmd]) {
+		len = strlen(sim->str[cmd]);
+		resp[0] = len;
+		memcpy(resp + 1, sim->str[cmd], len);
+		return len + 1;
+	}
 
-		msg[0].addr = msg[1].addr = pmdev->addr;
+	op = pmbus_cmd_lookup(cmd);
+	switch (op ? op->type : 0) {
+	case RW1:
+	case R1:
+		resp[0] = value;
+		return 1;
+	case RW2:
+	case R2:
+		resp[0] = value;
+		resp[1] = value >> 8;
+		return 2;
+	}
 
-		msg[0].flags = 0;
-		msg[0].len = 4;
-		msg[0].buf = data.block;
+	sim_cml(sim, 1 << 6);
+	return -EREMOTEIO;
+}
 
-		data.block[0] = PMB_COEFFICIENTS;
-		data.block[1] = 2;
-		data.block[2] = op->cmd;
-		data.block[3] = read;
+/* Apply a write of "cmd" and its data.  Returns zero or negative errno. */
+static int sim_store(struct sim_dev *sim, u8 cmd, const u8 *wdata, unsigned wlen)
+{
+	const struct pmbus_cmd_desc	*op;
+	unsigned			page;
 
-		msg[1].flags = I2C_M_RD;
-		msg[1].len = 6;
-		msg[1].buf = data.block;
+	if (!(sim->query[cmd] & (1 << 6))) {
+		sim_cml(sim, 1 << 7);
+		return -EREMOTEIO;
+	}
 
-		status = ioctl(pmdev->fd, I2C_RDWR, &msgdat);
+	if (cmd == PMB_CLEAR_FAULT) {
+		for (page = 0; page < SIM_MAX_PAGES; page++) {
+			sim->reg[page][PMB_STATUS_BYTE] = 0;
+			sim->reg[page][PMB_STATUS_WORD] = 0;
+			sim->reg[page][PMB_STATUS_CML] = 0;
+		}
+		return 0;
+	}
 
-	} else
-		status = -EOPNOTSUPP;
+	op = pmbus_cmd_lookup(cmd);
+	switch (op ? op->type : 0) {
+	case W0:
+		return 0;
+	case RW1:
+	case W1:
+		if (wlen != 1)
+			break;
+		if (cmd == 0x00) {
+			if (wdata[0] >= sim->pages && wdata[0] != 0xff)
+				break;
+			sim->page = (wdata[0] == 0xff) ? 0 : wdata[0];
+		}
+		sim->reg[sim->page][cmd] = wdata[0];
+		return 0;
+	case RW2:
+		if (wlen != 2)
+			break;
+		sim->reg[sim->page][cmd] = wdata[0] | (wdata[1] << 8);
+		return 0;
+	case RWB:
+	case RWB14:
+		return 0;
+	}
 
-	if (status < 0)
-		return;
+	sim_cml(sim, 1 << 6);
+	return -EREMOTEIO;
+}
 
-	if (data.block[0] != 5)
-		return;
+/* How much data a write of "cmd" carries, not counting any PEC */
+static unsigned sim_write_len(u8 cmd, const u8 *wdata, unsigned wlen)
+{
+	const struct pmbus_cmd_desc *op = pmbus_cmd_lookup(cmd);
 
-	c->m = (data.block[2] << 8) | data.block[1];
-	c->b = (data.block[4] << 8) | data.block[3];
-	c->R = data.block[5];
-	c->valid = 1;
+	switch (op ? op->type : 0) {
+	case W0:
+		return 0;
+	case RW1:
+	case W1:
+		return 1;
+	case RW2:
+		return 2;
+	case RWB:
+	case RWB14:
+		return wlen ? wdata[0] + 1 : 0;
+	default:
+		return wlen;
+	}
 }
 
-static void query(struct pmbus_dev *pmdev, struct pmbus_cmd_desc *op)
+/* Each byte on the wire is 9 clocks */
+static void sim_clock(struct sim_dev *sim, unsigned nbytes)
 {
-	struct i2c_smbus_ioctl_data	arg;
-	u16				word;
-
-	/* NOTE query for "extended" commands is not specified by PMBus 1.1;
-	 * presumably that will just send a two byte block (which can't use
-	 * the portability tweak below).  Fortunately there's no evident
-	 * need to support such two-byte commands yet.
-	 */
-	if (op->cmd > 0xff)
-		return;
+	sim->bytes += nbytes;
+	if (sim->khz)
+		sim->delay_ns += nbytes * 9 * 1000000UL / sim->khz;
+}
 
-	/* This is specified as a block proc call, which is currently not
-	 * widely supported.  Instead, implement this using normal proc
-	 * calls, which are more widely available.
-	 */
-	word = (op->cmd << 8) | 1;
+/* Account for one transaction on the wire; maybe inject a fault. */
+static int sim_wire(struct sim_dev *sim, u8 addr, unsigned nbytes)
+{
+	sim->xacts++;
 
-	memset(&arg, 0, sizeof arg);
-	arg.command = PMB_QUERY;
-	arg.size = I2C_SMBUS_PROC_CALL;
-	arg.data = (union i2c_smbus_data *) &word;
+	/* START and STOP */
+	sim_clock(sim, nbytes);
+	if (sim->khz)
+		sim->delay_ns += 2 * 1000000UL / sim->khz;
 
-	if (ioctl(pmdev->fd, I2C_SMBUS, &arg) < 0 || (word & 0x00ff) != 1) {
-		/* REVISIT we _really_ want QUERY to work, so it'd be nice
-		 * to recover from transient faults here.  If we could tell
-		 * such faults from real ones, that is... instead of seeing
-		 * false EPERM reports for everything in the I2C stack.
-		 */
-		pmdev->no_query = 1;
-		return;
+	if (sim->stretch_pct && sim_random(sim) % 100 < sim->stretch_pct) {
+		sim->stretches++;
+		sim->delay_ns += sim->stretch_us * 1000UL;
 	}
 
-	word >>= 8;
+	if (addr != sim->slave)
+		return -ENXIO;
 
-	/* query supported, but not this operation? */
-	if (!(word & (1 << 7))) {
-		pmdev->op[op->cmd] = &unsupported;
-		return;
+	if (sim->nack_pct && sim_random(sim) % 100 < sim->nack_pct) {
+		sim->nacks++;
+		return -EREMOTEIO;
 	}
+	return 0;
+}
 
-	/* The FSP PSUs that I'm testing this on *really* need a delay here */
-	usleep(1000);
+/* One transaction:  write (command and data), then maybe repeated START
+ * and read.  Returns the length of the response, else negative errno.
+ */
+static int sim_xact(struct sim_dev *sim, u8 addr, const u8 *w, unsigned wlen,
+		u8 *resp, unsigned rlen)
+{
+	int	status;
+
+	status = sim_wire(sim, addr, 1 + wlen + (rlen ? 1 + rlen : 0));
+	if (status < 0 || wlen == 0)
+		return status;
+
+	if (rlen == 0) {
+		/* one byte more than the data is the master's PEC */
+		if (wlen - 1 == sim_write_len(w[0], w + 1, wlen - 1) + 1) {
+			wlen--;
+			if (pmbus_pec(addr, w, wlen, NULL, 0) != w[wlen]) {
+				sim_cml(sim, 1 << 5);
+				return -EREMOTEIO;
+			}
+		}
+		return sim_store(sim, w[0], w + 1, wlen - 1);
+	}
 
-	/* NOTE eventually use copy/clone here instead of in-place mutate,
-	 * when managing multiple devices concurrently
-	 */
-	op->query = word;
-	pmdev->op[op->cmd] = op;
+	/* if the master keeps reading, it gets our PEC */
+	status = sim_respond(sim, w[0], w + 1, wlen - 1, resp);
+	if (status > 0)
+		resp[status] = pmbus_pec(addr, w, wlen, resp, status);
+	return status;
+}
 
-	/* Try to get the coefficients for DIRECT format numbers */
-	if (((word >> 2) & 7) == 3 && pmdev->op[PMB_COEFFICIENTS]) {
-		if (word & (1 << 5))	/* read (always) */
-			coefficients(pmdev, op, 1);
-		if (word & (1 << 6))	/* write */
-			coefficients(pmdev, op, 0);
-	}
+static void sim_begin(struct sim_dev *sim, struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+	sim->delay_ns = sim->latency_us * 1000UL;
+	sim->xfers++;
+}
 
-	if (op->cmd == PMB_VOUT_MODE) {
-		/* VOUT_MODE is a special snowflake, its coefficients are
-		 * at least per-page, not per-command.
-		 */
-		int value = pmbus_read_byte_data(pmdev->fd, op->cmd);
-		op->c[0].R = op->c[1].R = value;
-		return;
+static void sim_end(struct sim_dev *sim, const struct timespec *start)
+{
+	struct timespec	t = *start;
+	unsigned long	ns;
+
+	t.tv_nsec += sim->delay_ns % 1000000000UL;
+	t.tv_sec += sim->delay_ns / 1000000000UL + t.tv_nsec / 1000000000L;
+	t.tv_nsec %= 1000000000L;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL)
+			== EINTR)
+		continue;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	ns = (t.tv_sec - start->tv_sec) * 1000000000UL
+			+ t.tv_nsec - start->tv_nsec;
+	if (sim->nlat == sim->maxlat) {
+		size_t		n = sim->maxlat ? 2 * sim->maxlat : 1024;
+		unsigned long	*lat = realloc(sim->lat_ns, n * sizeof *lat);
+
+		if (!lat)
+			return;
+		sim->lat_ns = lat;
+		sim->maxlat = n;
 	}
-
+	sim->lat_ns[sim->nlat++] = ns;
 }
 
-/* Return:  negative = can't tell, 0 = no, 1 = yes */
-static int checksupport(struct pmbus_dev *pmdev, u16 cmd)
+static int sim_smbus(struct pmbus_dev *pmdev, struct i2c_smbus_ioctl_data *arg)
 {
-	/* NOTE:  no revision check.  QUERY is a PMBUS 1.1 addition,
-	 * but the device's PMBus revision may not be exposed.
-	 *
-	 * NOTE:  this assumes we can check prefixes for PMB_MFR_EXT(x)
-	 * and PMB_EXT(x) operations, even though we can't query those
-	 * operations directly...
-	 */
-	if (is_pmb_extended(cmd))
-		return -1;
-
-	if (pmdev->op[PMB_QUERY] == &unsupported || pmdev->no_query)
-		return -1;
+	struct sim_dev		*sim = pmdev->xport_data;
+	union i2c_smbus_data	*data = arg->data;
+	struct timespec		start;
+	u8			w[I2C_SMBUS_BLOCK_MAX + 3];
+	u8			r[258];
+	int			status;
 
-	if (!pmdev->op[cmd]) {
-		struct pmbus_cmd_desc *op = pmbus_ops;
+	sim_begin(sim, &start);
 
-		for (op = pmbus_ops; !pmdev->no_query && op->tag; op++) {
-			if (op->cmd == cmd) {
-				query(pmdev, op);
+	w[0] = arg->command;
+	switch (arg->size) {
+	case I2C_SMBUS_QUICK:
+		status = sim_xact(sim, sim->addr, NULL, 0, NULL, 0);
+		break;
+	case I2C_SMBUS_BYTE:
+		if (arg->read_write == I2C_SMBUS_READ) {
+			status = -EOPNOTSUPP;
+			break;
+		}
+		status = sim_xact(sim, sim->addr, w, 1, NULL, 0);
+		break;
+	case I2C_SMBUS_BYTE_DATA:
+		if (arg->read_write == I2C_SMBUS_READ) {
+			status = sim_xact(sim, sim->addr, w, 1, r, 1);
+			if (status >= 0)
+				data->byte = r[0];
+		} else {
+			w[1] = data->byte;
+			status = sim_xact(sim, sim->addr, w, 2, NULL, 0);
+		}
+		break;
+	case I2C_SMBUS_WORD_DATA:
+		if (arg->read_write == I2C_SMBUS_READ) {
+			status = sim_xact(sim, sim->addr, w, 1, r, 2);
+			if (status >= 0)
+				data->word = r[0] | (r[1] << 8);
+		} else {
+			w[1] = data->word;
+			w[2] = data->word >> 8;
+			status = sim_xact(sim, sim->addr, w, 3, NULL, 0);
+		}
+		break;
+	case I2C_SMBUS_PROC_CALL:
+		w[1] = data->word;
+		w[2] = data->word >> 8;
+		status = sim_xact(sim, sim->addr, w, 3, r, 2);
+		if (status >= 0)
+			data->word = r[0] | (r[1] << 8);
+		break;
+	case I2C_SMBUS_BLOCK_DATA:
+		if (arg->read_write == I2C_SMBUS_READ) {
+			status = sim_xact(sim, sim->addr, w, 1, r, 1);
+			if (status < 0)
+				break;
+			sim_clock(sim, r[0]);
+			/* like most adapters, refuse oversized blocks */
+			if (r[0] > I2C_SMBUS_BLOCK_MAX) {
+				status = -EPROTO;
 				break;
 			}
+			memcpy(data->block, r, r[0] + 1);
+			break;
+		}
+		/* FALLTHROUGH */
+	case I2C_SMBUS_BLOCK_PROC_CALL:
+		if (data->block[0] > I2C_SMBUS_BLOCK_MAX) {
+			status = -EINVAL;
+			break;
+		}
+		memcpy(w + 1, data->block, data->block[0] + 1);
+		if (arg->size == I2C_SMBUS_BLOCK_DATA) {
+			status = sim_xact(sim, sim->addr, w,
+					data->block[0] + 2, NULL, 0);
+			break;
+		}
+		status = sim_xact(sim, sim->addr, w, data->block[0] + 2, r, 1);
+		if (status < 0)
+			break;
+		sim_clock(sim, r[0]);
+		if (r[0] > I2C_SMBUS_BLOCK_MAX) {
+			status = -EPROTO;
+			break;
 		}
+		memcpy(data->block, r, r[0] + 1);
+		break;
+	default:
+		status = -EOPNOTSUPP;
+		break;
 	}
 
-	return pmdev->op[cmd] != &unsupported;
+	sim_end(sim, &start);
+	return (status < 0) ? status : 0;
 }
 
-static char *pmbus_read_string(struct pmbus_dev *pmdev, u16 cmd)
+static int sim_rdwr(struct pmbus_dev *pmdev, struct i2c_rdwr_ioctl_data *msgdat)
 {
-	u8 buf[256];
-	int status;
-
-	/* For non-queryable devices we'll still try to read inventory
-	 * data strings.  That should be harmless but informative.
-	 */
-	if (checksupport(pmdev, cmd) == 0)
-		return NULL;
-
-	memset(buf, 0, sizeof buf);
-	status = pmbus_read_block(pmdev, cmd, sizeof buf - 1, buf);
-	return (status > 0) ? strdup((void *)buf) : NULL;
-}
-
-/*----------------------------------------------------------------------*/
+	struct sim_dev		*sim = pmdev->xport_data;
+	struct timespec		start;
+	unsigned		i;
+	int			status = 0;
 
-static char *units(struct pmbus_cmd_desc *op)
-{
-	switch (op->units) {
-	case VOLTS:
-		return "Volts";
-	case AMPERES:
-		return "Amperes";
-	case MILLISECONDS:
-		return "milliseconds";
-	case DEGREES_C:
-		return "degrees Celsius";
-	case WATTS:
-		return "Watts";
-	default:
-		return NULL;
-	}
-}
+	if (msgdat->nmsgs > I2C_RDWR_IOCTL_MAX_MSGS)
+		return -EINVAL;
 
+	sim_begin(sim, &start);
 
-/*----------------------------------------------------------------------*/
+	for (i = 0; i < msgdat->nmsgs && status >= 0; i++) {
+		struct i2c_msg	*msg = &msgdat->msgs[i];
+		struct i2c_msg	*rd = NULL;
+		u8		resp[258];
+		unsigned	len;
+		int		extra = 0;
 
-static void pmbus_list_inventory(struct pmbus_dev *pmdev)
-{
-	char *mfr = pmbus_read_string(pmdev, PMB_MFR_ID);
-	char *model = pmbus_read_string(pmdev, PMB_MFR_MODEL);
-	char *revision = pmbus_read_string(pmdev, PMB_MFR_REVISION);
-	char *location = pmbus_read_string(pmdev, PMB_MFR_LOCATION);
-	char *date = pmbus_read_string(pmdev, PMB_MFR_DATE);
-	char *serial = pmbus_read_string(pmdev, PMB_MFR_SERIAL);
-	char *ic_device_id = pmbus_read_string(pmdev, PMB_IC_DEVICE_ID);
-	char *ic_device_rev = pmbus_read_string(pmdev, PMB_IC_DEVICE_REV);
+		/* lone reads ("receive byte") aren't used with PMBus */
+		if (msg->flags & I2C_M_RD) {
+			status = -EOPNOTSUPP;
+			break;
+		}
+		if (i + 1 < msgdat->nmsgs
+				&& (msgdat->msgs[i + 1].flags & I2C_M_RD)
+				&& msgdat->msgs[i + 1].addr == msg->addr)
+			rd = &msgdat->msgs[++i];
+
+		if (!rd) {
+			status = sim_xact(sim, msg->addr, msg->buf, msg->len,
+					NULL, 0);
+			continue;
+		}
 
-	if (!mfr && !model && !revision && !location && !date && !serial
-			&& !ic_device_id &&!ic_device_rev)
-		return;
+		len = rd->len;
+		if (rd->flags & I2C_M_RECV_LEN) {
+			/* i2c-dev sanity checks */
+			extra = rd->buf[0];
+			if (extra < 1 || extra > 2
+					|| len < extra + I2C_SMBUS_BLOCK_MAX) {
+				status = -EINVAL;
+				break;
+			}
+			len = extra;
+		}
 
-	/* REVISIT might be useful to fetch all these strings and save
-	 * them away.  They're the first handle we have on just what
-	 * kind of device we're working with...
-	 */
+		memset(resp, 0xff, sizeof resp);
+		status = sim_xact(sim, msg->addr, msg->buf, msg->len, resp, len);
+		if (status < 0)
+			break;
 
-	printf("Inventory Data:\n");
-	if (mfr) {
-		printf("  Manufacturer:\t\t%s\n", mfr);
-		free(mfr);
-	}
-	if (model) {
-		printf("  Model:\t\t%s\n", model);
-		free(model);
-	}
-	if (mfr) {
-		printf("  Revision:\t\t%s\n", revision);
-		free(revision);
-	}
-	if (location) {
-		printf("  Built at:\t\t%s\n", location);
-		free(location);
-	}
-	if (date) {
-		printf("  Built on:\t\t%s\n", date);
-		free(date);
-	}
-	if (serial) {
-		printf("  Serial:\t\t%s\n", serial);
-		free(serial);
-	}
-	if (ic_device_id) {
-		printf("  IC Device:\t\t%s\n", ic_device_id);
-		free(ic_device_id);
-	}
-	if (ic_device_rev) {
-		printf("  IC Device Revision:\t\t%s\n", ic_device_rev);
-		free(ic_device_rev);
+		if (rd->flags & I2C_M_RECV_LEN) {
+			sim_clock(sim, resp[0]);
+			if (resp[0] > I2C_SMBUS_BLOCK_MAX) {
+				status = -EPROTO;
+				break;
+			}
+			len = resp[0] + extra;
+		}
+		memcpy(rd->buf, resp, len);
 	}
-	printf("\n");
+
+	sim_end(sim, &start);
+	return (status < 0) ? status : (int) msgdat->nmsgs;
 }
 
-static void pmbus_dev_show_p1(struct pmbus_dev *pmdev)
+static int sim_pec(struct pmbus_dev *pmdev, bool enable)
 {
-	const char		*s0, *s1;
-	struct pmbus_cmd_desc	*op;
-
-	printf("PMBus slave on %s, address %#02x\n\n", pmdev->bus, pmdev->addr);
+	/* SMBus PEC would be handled by the kernel; nothing to do here */
+	return 0;
+}
 
-	pmbus_list_inventory(pmdev);
+static int sim_set_addr(struct pmbus_dev *pmdev, u8 addr, bool force)
+{
+	struct sim_dev *sim = pmdev->xport_data;
 
-	/*
-	 * NOTE spec bug:  table shows two four bit masks, which are
-	 * described as two fields, 3 bits 7-5 and 5 bits 4-0  ... in
-	 * fact part II probably deserves an extra bit.  Rev 1.0 of the
-	 * spec said the fields are 3 and 5 bits; let's be compatible.
-	 */
-	switch ((pmdev->revision >> 5) & 0x07) {
-	case 0:		s1 = "1.0"; break;
-	case 1:		s1 = "1.1"; break;
-	case 2:		s1 = "1.2"; break;
-	default:	s1 = "?"; break;
-	}
-	switch (pmdev->revision & 0x1f) {
-	case 0:		s0 = "1.0"; break;
-	case 1:		s0 = "1.1"; break;
-	case 2:		s0 = "1.2"; break;
-	default:	s0 = "?"; break;
-	}
-	printf("PMBus revisions (%#02x):\tpart I, ver %s; part II, ver %s\n",
-		pmdev->revision, s1, s0);
+	sim->addr = addr;
+	return 0;
+}
 
-	if (pmdev->capability & 0xf0) {
-		switch ((pmdev->capability >> 5) & 3) {
-		case 0:		s0 = "100 KHz"; break;
-		case 1:		s0 = "400 KHz"; break;
-		default:	s0 = "?speed?"; break;
-		}
-		printf("Capabilities (%#02x):\t%s%s%s\n",
-			pmdev->capability,
-			(pmdev->capability & (1 << 7)) ? "PEC, " : "",
-			(pmdev->capability & (1 << 4)) ? "SMBALERT#, ": "",
-			s0);
+static int sim_open(struct pmbus_dev *pmdev, const char *bus)
+{
+	struct sim_dev	*sim;
+	char		*opts, *opt, *save = NULL;
+	int		status = 0;
+
+	sim = calloc(1, sizeof *sim);
+	if (!sim)
+		return -ENOMEM;
+	sim->slave = 0x58;
+	sim->pages = 1;
+	sim->rand = 1;
+	pmdev->funcs = I2C_FUNC_I2C
+		| I2C_FUNC_SMBUS_QUICK
+		| I2C_FUNC_SMBUS_WRITE_BYTE
+		| I2C_FUNC_SMBUS_BYTE_DATA
+		| I2C_FUNC_SMBUS_WORD_DATA
+		| I2C_FUNC_SMBUS_PROC_CALL
+		| I2C_FUNC_SMBUS_BLOCK_DATA
+		| I2C_FUNC_SMBUS_BLOCK_PROC_CALL
+		| I2C_FUNC_SMBUS_PEC;
+
+	opts = strdup(bus + 3);
+	if (!opts) {
+		free(sim);
+		return -ENOMEM;
 	}
-	printf("\n");
-
-	if (checksupport(pmdev, PMB_APP_PROFILES) == 1) {
-		printf("Application Profiles:\n");
-
-		u8 buf[513];
-		int size = pmbus_read_block(pmdev, PMB_APP_PROFILES, sizeof(buf), buf);
-		for (int i = 0; size > 1 && i < size / 2; ++i) {
-			u8 profile_id = buf[2 * i];
-			u8 revision = buf[2 * i + 1];
-			if (profile_id == 0) {
-				printf(" No Application Profiles\n");
-			} else {
-				switch (profile_id) {
-				case 0:
-					/* handled above */
-					break;
-				case 1:
-					printf(" Server AC-DC Power Supply");
-					break;
-				case 2:
-					printf(" DC-DC Converters for Microprocessor Power and other Copmuter Applications");
-					break;
-				case 3:
-					printf(" DC-DC Converters for General-Purpose Use");
-					break;
-				default:
-					printf(" (reserved)");
-				}
-				printf(": rev %d.%d\n", (revision >> 4), (revision & 0xf));
-			}
+	for (opt = strtok_r(*opts == ':' ? opts + 1 : opts, ",", &save);
+			opt && status == 0;
+			opt = strtok_r(NULL, ",", &save)) {
+		char		*val = strchr(opt, '=');
+		unsigned long	n;
+
+		if (!val) {
+			status = -EINVAL;
+			break;
 		}
-		printf("\n");
+		*val++ = '\0';
+		n = strtoul(val, NULL, 0);
+
+		if (strcmp(opt, "addr") == 0)
+			sim->slave = n;
+		else if (strcmp(opt, "format") == 0) {
+			if (strcmp(val, "direct") == 0)
+				sim->direct = 1;
+			else if (strcmp(val, "linear") != 0)
+				status = -EINVAL;
+		} else if (strcmp(opt, "vout") == 0) {
+			if (strcmp(val, "direct") == 0)
+				sim->vout_direct = 1;
+			else if (strcmp(val, "linear") != 0)
+				status = -EINVAL;
+		} else if (strcmp(opt, "rev") == 0) {
+			if (strcmp(val, "1.0") == 0)
+				sim->rev10 = 1;
+			else if (strcmp(val, "1.1") != 0)
+				status = -EINVAL;
+		} else if (strcmp(opt, "pages") == 0) {
+			if (n < 1 || n > SIM_MAX_PAGES)
+				status = -EINVAL;
+			sim->pages = n;
+		} else if (strcmp(opt, "latency") == 0)
+			sim->latency_us = n;
+		else if (strcmp(opt, "khz") == 0)
+			sim->khz = n;
+		else if (strcmp(opt, "nack") == 0)
+			sim->nack_pct = n;
+		else if (strcmp(opt, "stretch") == 0) {
+			char *us = strchr(val, ':');
+
+			sim->stretch_pct = n;
+			sim->stretch_us = us ? strtoul(us + 1, NULL, 0) : 100;
+		} else if (strcmp(opt, "seed") == 0)
+			sim->rand = n ? n : 1;
+		else if (strcmp(opt, "funcs") == 0)
+			pmdev->funcs = n;
+		else
+			status = -EINVAL;
 	}
+	free(opts);
 
-	if (pmdev->no_query) {
-		printf("Device can't QUERY for supported commands\n");
-		return;
+	if (status < 0) {
+		free(sim);
+		return status;
 	}
 
-	for (op = pmbus_ops; !pmdev->no_query && op->tag; op++)
-		query(pmdev, op);
+	sim_init(sim);
+	pmdev->xport_data = sim;
+	return 0;
 }
 
-/*----------------------------------------------------------------------*/
-
-static void showbits(u16 mask, int i, char *bits[])
+static int cmp_ulong(const void *a, const void *b)
 {
-	int comma = 0;
+	unsigned long x = *(const unsigned long *) a;
+	unsigned long y = *(const unsigned long *) b;
 
-	while (i-- > 0) {
-		if (!(mask & (1 << i)))
-			continue;
-		printf("%s%s", comma++ ? ", " : "", bits[i] ? : "?");
-	}
+	return (x > y) - (x < y);
 }
 
-void status_byte(struct pmbus_dev *pmdev, u16 cmd, char *label, char *bits[])
+static void sim_close(struct pmbus_dev *pmdev)
 {
-	int value;
-	int mode;
+	struct sim_dev *sim = pmdev->xport_data;
 
-	mode = checksupport(pmdev, cmd);
-	if (mode == 0)
-		return;
-	value = pmbus_read_byte_data(pmdev->fd, cmd);
-	if (value < 0) {
-		if (mode == 1)
-			printf("  ** Device failed read of STATUS_%s?\n",
-					label);
+	if (!sim)
 		return;
+
+	if (verbose && sim->nlat) {
+		unsigned long	sum = 0;
+		size_t		i;
+
+		fflush(stdout);
+		qsort(sim->lat_ns, sim->nlat, sizeof *sim->lat_ns, cmp_ulong);
+		for (i = 0; i < sim->nlat; i++)
+			sum += sim->lat_ns[i];
+		fprintf(stderr, "sim: %lu transfers, %lu transactions, "
+				"%lu bytes, %lu NACKs, %lu clock stretches\n",
+				sim->xfers, sim->xacts, sim->bytes,
+				sim->nacks, sim->stretches);
+		fprintf(stderr, "sim: transfer usec: min %.1f avg %.1f "
+				"p50 %.1f p99 %.1f max %.1f\n",
+				sim->lat_ns[0] / 1000.0,
+				sum / 1000.0 / sim->nlat,
+				sim->lat_ns[sim->nlat / 2] / 1000.0,
+				sim->lat_ns[sim->nlat * 99 / 100] / 1000.0,
+				sim->lat_ns[sim->nlat - 1] / 1000.0);
 	}
-	printf("  %-21s %02x: ", label, value);
-	showbits(value, 8, bits);
-	printf("\n");
+
+	free(sim->lat_ns);
+	free(sim);
+	pmdev->xport_data = NULL;
 }
 
-static void show_status_vout(struct pmbus_dev *pmdev)
-{
-	static char *bits[8] = {
-		"VOUT Tracking Error",
-		"TOFF_MAX_WARNING",
-		"TON_MAX_FAULT",
-		"Attempted to exceed VOUT_MAX",
-		"Output Undervoltage Fault",
-		"Output Undervoltage Warning",
-		"Output Overvoltage Warning",
-		"Output Overvoltage Fault",
-	};
+static const struct pmbus_transport sim_transport = {
+	.name		= "sim",
+	.open		= sim_open,
+	.set_addr	= sim_set_addr,
+	.close		= sim_close,
+	.smbus		= sim_smbus,
+	.rdwr		= sim_rdwr,
+	.pec		= sim_pec,
+};
 
-	status_byte(pmdev, PMB_STATUS_VOUT, "VOUT", bits);
+/* "-b sim..." picks the simulator; anything else is an i2c-dev node */
+static const struct pmbus_transport *pmbus_transport_for(const char *bus)
+{
+	if (strncmp(bus, "sim", 3) == 0 && (bus[3] == '\0' || bus[3] == ':'))
+		return &sim_transport;
+	return &i2cdev_transport;
 }
 
-static void show_status_iout(struct pmbus_dev *pmdev)
-{
-	static char *bits[8] = {
-		"Output Overpower Warning",
-		"Output Overpower Fault",
-		"In Power Limiting Mode",
-		"Current Share Fault",
-		"Output Undercurrent Fault",
-		"Output Overcurrent Warning",
+/*----------------------------------------------------------------------*/
+
+/*
+ * The only userspace code for SMBus ops I found comes with a libsensors
+ * package that clobbers <linux/i2c-dev.h> on install.  And what we need
+ * is PMBus ops anyway... hence this code, which understands some of the
+ * ways that PMBus differs from SMBus.
+ *
+ * Use of 2-byte commands is rejected, but comments show how it could
+ * be implemented with reasonable portability.
+ *
+ * REVISIT return values handling ... "errno" seems to be meaningless
+ * since it's almost always EPERM (1), sigh.
+ */
+
+/* Send a bit to the device, if it's present. */
+static inline int smbus_quick(struct pmbus_dev *pmdev, int flag)
+{
+	struct i2c_smbus_ioctl_data	arg;
+
+	memset(&arg, 0, sizeof arg);
+	arg.read_write = flag ? I2C_SMBUS_READ : I2C_SMBUS_WRITE;
+	/* no command */
+	arg.size = I2C_SMBUS_QUICK;
+	/* no data */
+
+	return pmbus_xfer_smbus(pmdev, &arg);
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * READ operations
+ */
+
+/* Returns a byte, or negative errno. */
+static int pmbus_read_byte_data(struct pmbus_dev *pmdev, u16 cmd)
+{
+	struct i2c_smbus_ioctl_data	arg;
+	u8				byte;
+	int				status;
+
+	/* use i2c; or READ_I2C_BLOCK_2: 2 byte cmd, 1 byte block */
+	if (is_pmb_extended(cmd))
+		return -ENOSYS;
+
+	if (!is_pmb_8bit(cmd))
+		return -EINVAL;
+
+	memset(&arg, 0, sizeof arg);
+	arg.read_write = I2C_SMBUS_READ;
+	arg.command = cmd;
+	arg.size = I2C_SMBUS_BYTE_DATA;
+	arg.data = (union i2c_smbus_data *) &byte;
+
+	status = pmbus_xfer_smbus(pmdev, &arg);
+	if (status < 0)
+		return status;
+
+	return byte;
+}
+
+/* Returns a word, or negative errno. */
+static int pmbus_read_word_data(struct pmbus_dev *pmdev, u16 cmd)
+{
+	struct i2c_smbus_ioctl_data	arg;
+	u16				word;
+	int				status;
+
+	/* use i2c; or READ_I2C_BLOCK_2: 2 byte cmd, 2 byte block */
+	if (is_pmb_extended(cmd))
+		return -ENOSYS;
+
+	if (!is_pmb_8bit(cmd))
+		return -EINVAL;
+
+	memset(&arg, 0, sizeof arg);
+	arg.read_write = I2C_SMBUS_READ;
+	arg.command = cmd;
+	arg.size = I2C_SMBUS_WORD_DATA;
+	arg.data = (union i2c_smbus_data *) &word;
+
+	status = pmbus_xfer_smbus(pmdev, &arg);
+	if (status < 0)
+		return status;
+
+	/* adapter code handled byteswapping if needed */
+	return word;
+}
+
+static int pmbus_read_block_without_checking(struct pmbus_dev *pmdev, u16 cmd,
+		unsigned read_len, int advertised_len, u8 *read_buf)
+{
+	struct i2c_smbus_ioctl_data	arg;
+	union i2c_smbus_data		data;
+	int				retval;
+
+	if (!read_buf || read_len == 0)
+		return -EINVAL;
+
+	/* use i2c; or READ_I2C_BLOCK_2: 2 byte cmd, N byte block */
+	if (is_pmb_extended(cmd))
+		return -ENOSYS;
+
+	if (!is_pmb_8bit(cmd))
+		return -EINVAL;
+
+	if (advertised_len > I2C_SMBUS_BLOCK_MAX) {
+		retval = -EFBIG;
+		goto try_i2c;
+	}
+
+	/* If there's no SMBus support, I2C will work (we checked).
+	 * Or, we might use "I2C block read" for up to 31 data bytes.
+	 */
+	if (!(pmdev->funcs & I2C_FUNC_SMBUS_READ_BLOCK_DATA)) {
+		retval = -EOPNOTSUPP;
+		goto try_i2c;
+	}
+
+	memset(&arg, 0, sizeof arg);
+	arg.read_write = I2C_SMBUS_READ;
+	arg.command = cmd;
+	arg.size = I2C_SMBUS_BLOCK_DATA;
+	arg.data = &data;
+
+	/* When this fails, we can't really know why.  In case it's the
+	 * SMBus code saying "block too big", try again (if possible).
+	 */
+	retval = pmbus_xfer_smbus(pmdev, &arg);
+	if (retval < 0)
+		goto try_i2c;
+
+	if (data.block[0] <= read_len) {
+		if (data.block[0] > 32) {
+			/* NOTE:  this probably won't be visible */
+			retval = -EFBIG;
+			goto try_i2c;
+		}
+		retval = read_len = data.block[0];
+	} else
+		retval = -E2BIG;
+	memcpy(read_buf, &data.block[1], read_len);
+
+	return retval;
+
+try_i2c:
+	/* PEC, if it's in use, is checked here in userspace */
+	if (pmdev->funcs & I2C_FUNC_I2C) {
+		struct i2c_msg			msg[2];
+		struct i2c_rdwr_ioctl_data	msgdat;
+		u8				cmdbuf[1];
+		u8				buf[1 + 255 + 1];
+
+		msgdat.msgs = msg;
+		msgdat.nmsgs = 2;
+
+		msg[0].addr = msg[1].addr = pmdev->addr;
+
+		cmdbuf[0] = cmd & 0x0ff;
+
+		msg[0].flags = 0;
+		msg[0].len = 1;
+		msg[0].buf = cmdbuf;
+
+		msg[1].flags = I2C_M_RD;
+		msg[1].len = advertised_len + 1 + !!pmdev->use_pec;
+		msg[1].buf = buf;
+
+		retval = pmbus_xfer_rdwr(pmdev, &msgdat);
+		if (retval < 0)
+			return retval;
+
+		if (buf[0] <= read_len && buf[0] <= advertised_len)
+			retval = read_len = buf[0];
+		else {
+			/* Too big for the caller, or it grew since we were
+			 * told its length; either way it's truncated.
+			 */
+			if (read_len > advertised_len)
+				read_len = advertised_len;
+			retval = -E2BIG;
+		}
+
+		/* PEC follows the data, if we read that far */
+		if (pmdev->use_pec && buf[0] <= advertised_len
+				&& pmbus_pec(pmdev->addr, cmdbuf, 1,
+						buf, buf[0] + 1)
+					!= buf[buf[0] + 1])
+			return -EBADMSG;
+
+		memcpy(read_buf, &buf[1], read_len);
+	}
+
+	return retval;
+}
+
+/* Read just the byte count at the head of a block.  There's no PEC to
+ * check on such a partial read, so over SMBus the kernel's PEC has to be
+ * turned off around it; plain I2C messages avoid those extra calls.
+ */
+static int pmbus_read_block_len(struct pmbus_dev *pmdev, u16 cmd)
+{
+	int				len;
+
+	if (pmdev->funcs & I2C_FUNC_I2C) {
+		struct i2c_msg			msg[2];
+		struct i2c_rdwr_ioctl_data	msgdat;
+		u8				buf[1];
+
+		msgdat.msgs = msg;
+		msgdat.nmsgs = 2;
+
+		msg[0].addr = msg[1].addr = pmdev->addr;
+
+		buf[0] = cmd;
+		msg[0].flags = 0;
+		msg[0].len = 1;
+		msg[0].buf = buf;
+
+		msg[1].flags = I2C_M_RD;
+		msg[1].len = 1;
+		msg[1].buf = buf;
+
+		len = pmbus_xfer_rdwr(pmdev, &msgdat);
+		return (len < 0) ? len : buf[0];
+	}
+
+	if (pmdev->use_pec) {
+		if (pmbus_xfer_pec(pmdev, 0)) {
+			fprintf(stderr, "Cannot temporarily disable PEC");
+		}
+	}
+	len = pmbus_read_byte_data(pmdev, cmd);
+	if (pmdev->use_pec) {
+		if (pmbus_xfer_pec(pmdev, 1)) {
+			fprintf(stderr, "Cannot re-enable PEC");
+		}
+	}
+	return len;
+}
+
+/* Block read in a single I2C transaction, with the adapter picking up
+ * the byte count as it arrives (I2C_M_RECV_LEN).  That's how i2c-core
+ * emulates SMBus block reads, so adapters that do I2C and claim SMBus
+ * block reads can handle it.  Blocks are still limited to 32 bytes.
+ *
+ * Returns as pmbus_read_block(), or -EOPNOTSUPP if it can't be tried.
+ */
+static int pmbus_read_block_recv_len(struct pmbus_dev *pmdev, u16 cmd,
+		unsigned read_len, u8 *read_buf)
+{
+	struct i2c_msg			msg[2];
+	struct i2c_rdwr_ioctl_data	msgdat;
+	u8				cmdbuf[1];
+	u8				buf[1 + I2C_SMBUS_BLOCK_MAX + 1];
+	int				retval;
+
+	if ((pmdev->funcs & (I2C_FUNC_I2C | I2C_FUNC_SMBUS_READ_BLOCK_DATA))
+			!= (I2C_FUNC_I2C | I2C_FUNC_SMBUS_READ_BLOCK_DATA))
+		return -EOPNOTSUPP;
+
+	if (pmdev->no_recv_len)
+		return -EOPNOTSUPP;
+
+	msgdat.msgs = msg;
+	msgdat.nmsgs = 2;
+
+	msg[0].addr = msg[1].addr = pmdev->addr;
+
+	cmdbuf[0] = cmd;
+	msg[0].flags = 0;
+	msg[0].len = 1;
+	msg[0].buf = cmdbuf;
+
+	/* buf[0] tells the adapter how many bytes to add to the count:
+	 * the count itself, and the PEC byte if there is one.
+	 */
+	buf[0] = pmdev->use_pec ? 2 : 1;
+	msg[1].flags = I2C_M_RD | I2C_M_RECV_LEN;
+	msg[1].len = sizeof buf;
+	msg[1].buf = buf;
+
+	retval = pmbus_xfer_rdwr(pmdev, &msgdat);
+	if (retval == -EINVAL || retval == -EOPNOTSUPP) {
+		pmdev->no_recv_len = 1;
+		return -EOPNOTSUPP;
+	}
+	if (retval < 0)
+		return retval;
+
+	if (buf[0] > I2C_SMBUS_BLOCK_MAX)
+		return -EPROTO;
+	if (pmdev->use_pec && pmbus_pec(pmdev->addr, cmdbuf, 1, buf, buf[0] + 1)
+			!= buf[buf[0] + 1])
+		return -EBADMSG;
+	if (buf[0] <= read_len)
+		retval = read_len = buf[0];
+	else
+		retval = -E2BIG;
+	memcpy(read_buf, &buf[1], read_len);
+
+	return retval;
+}
+
+/* Returns the number of bytes copied into read_buf, or negative errno.
+ * If the block is bigger than read_len, read_len is copied and -E2BIG
+ * is returned (so the caller can recover, somewhat).
+ */
+static int pmbus_read_block(struct pmbus_dev *pmdev, u16 cmd,
+		unsigned read_len, u8 *read_buf)
+{
+	int				retval;
+	int				len;
+
+	if (!read_buf || read_len == 0)
+		return -EINVAL;
+
+	/* use i2c; or READ_I2C_BLOCK_2: 2 byte cmd, N byte block */
+	if (is_pmb_extended(cmd))
+		return -ENOSYS;
+
+	if (!is_pmb_8bit(cmd))
+		return -EINVAL;
+
+	/* Most blocks fit in one SMBus block, so try for that first.
+	 * Anything else (including bigger blocks, which the adapter
+	 * will have refused) goes the long way around.
+	 */
+	len = pmdev->block_len[cmd];
+	if (len <= I2C_SMBUS_BLOCK_MAX) {
+		retval = pmbus_read_block_recv_len(pmdev, cmd,
+				read_len, read_buf);
+		if (retval >= 0 || retval == -E2BIG)
+			return retval;
+	}
+
+	/* Inventory strings, user data and so on don't change size, so
+	 * when we've seen the block before we can skip asking its length.
+	 * If it turns out to have changed, forget what we knew and ask.
+	 */
+	if (len) {
+		retval = pmbus_read_block_without_checking(pmdev, cmd,
+				read_len, len, read_buf);
+		if (retval == len || (retval == -E2BIG && len > read_len))
+			return retval;
+		if (retval != -E2BIG && retval < 0)
+			return retval;
+		pmdev->block_len[cmd] = 0;
+	}
+
+	/* Handle "large" blocks sanely by issuing an extra read to
+	 * prevent one fault-path traversal (e.g. SMBALERT#) when the
+	 * block is bigger than the morsel allowed by SMBus.
+	 */
+	len = pmbus_read_block_len(pmdev, cmd);
+	if (len < 0)
+		return len;
+	pmdev->block_len[cmd] = len;
+
+	return pmbus_read_block_without_checking(pmdev, cmd, read_len, len, read_buf);
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * Batched reads:  many byte and word reads packed into each I2C_RDWR
+ * call, as write+read message pairs joined by repeated STARTs.  That's
+ * one syscall (and one adapter setup) for up to 21 registers, instead
+ * of one each.  Results are decoded afterwards, with PEC checked here.
+ *
+ * If a batch fails as a whole (one NACK aborts the rest) its commands
+ * are retried one at a time, so each gets its own error code.
+ */
+struct pmbus_batch_req {
+	u16		cmd;
+	u8		len;		/* 1 = byte, 2 = word */
+	int		value;		/* result, or negative errno */
+	u64		ns;		/* when read, per CLOCK_MONOTONIC */
+};
+
+#define PMBUS_BATCH_MAX		(I2C_RDWR_IOCTL_MAX_MSGS / 2)
+
+static void pmbus_read_one(struct pmbus_dev *pmdev, struct pmbus_batch_req *req)
+{
+	if (req->len == 1)
+		req->value = pmbus_read_byte_data(pmdev, req->cmd);
+	else
+		req->value = pmbus_read_word_data(pmdev, req->cmd);
+	req->ns = pmbus_xfer_time_ns(pmdev);
+}
+
+static int pmbus_read_batch_chunk(struct pmbus_dev *pmdev,
+		struct pmbus_batch_req *req, unsigned n)
+{
+	struct i2c_msg			msg[2 * PMBUS_BATCH_MAX];
+	struct i2c_rdwr_ioctl_data	msgdat;
+	u8				cmdbuf[PMBUS_BATCH_MAX];
+	u8				buf[PMBUS_BATCH_MAX][3];
+	unsigned			i;
+	int				status;
+
+	for (i = 0; i < n; i++) {
+		/* use i2c; or READ_I2C_BLOCK_2: 2 byte cmd */
+		if (!is_pmb_8bit(req[i].cmd))
+			return -EINVAL;
+
+		cmdbuf[i] = req[i].cmd;
+
+		msg[2 * i].addr = pmdev->addr;
+		msg[2 * i].flags = 0;
+		msg[2 * i].len = 1;
+		msg[2 * i].buf = &cmdbuf[i];
+
+		msg[2 * i + 1].addr = pmdev->addr;
+		msg[2 * i + 1].flags = I2C_M_RD;
+		msg[2 * i + 1].len = req[i].len + !!pmdev->use_pec;
+		msg[2 * i + 1].buf = buf[i];
+	}
+
+	msgdat.msgs = msg;
+	msgdat.nmsgs = 2 * n;
+
+	status = pmbus_xfer_rdwr(pmdev, &msgdat);
+	if (status < 0)
+		return status;
+
+	for (i = 0; i < n; i++) {
+		/* assume the messages were evenly spaced */
+		req[i].ns = pmdev->xfer_start_ns + (2 * i + 1)
+			* (pmdev->xfer_end_ns - pmdev->xfer_start_ns) / (2 * n);
+		if (pmdev->use_pec && pmbus_pec(pmdev->addr, &cmdbuf[i], 1,
+					buf[i], req[i].len)
+				!= buf[i][req[i].len])
+			req[i].value = -EBADMSG;
+		else if (req[i].len == 1)
+			req[i].value = buf[i][0];
+		else
+			req[i].value = buf[i][0] | (buf[i][1] << 8);
+	}
+	return 0;
+}
+
+static void pmbus_read_batch(struct pmbus_dev *pmdev,
+		struct pmbus_batch_req *req, unsigned n)
+{
+	unsigned	i, chunk;
+
+	while (n) {
+		chunk = (n > PMBUS_BATCH_MAX) ? PMBUS_BATCH_MAX : n;
+
+		if (!(pmdev->funcs & I2C_FUNC_I2C)
+				|| pmbus_read_batch_chunk(pmdev, req, chunk) < 0) {
+			for (i = 0; i < chunk; i++)
+				pmbus_read_one(pmdev, &req[i]);
+		}
+		req += chunk;
+		n -= chunk;
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * WRITE operations
+ */
+
+/* This is ONLY to temporarily shut up some gcc warnings; most
+ * of the write-side infrastructure is not yet used here.
+ */
+#define SHADDAP	inline
+
+/* With PMBus, transactions may never start with the "read" bit set.
+ * That includes "Quick" messages.  Break that rule and get a CML
+ * alert (e.g. SMBALERT#).
+ */
+static int pmbus_quick(struct pmbus_dev *pmdev)
+{
+	return smbus_quick(pmdev, 0);
+}
+
+/* Returns zero, or negative errno. */
+static int smbus_write_byte(struct pmbus_dev *pmdev, u8 byte)
+{
+	struct i2c_smbus_ioctl_data	arg;
+
+	memset(&arg, 0, sizeof arg);
+	arg.read_write = I2C_SMBUS_WRITE;
+	arg.command = byte;
+	arg.size = I2C_SMBUS_BYTE;
+
+	return pmbus_xfer_smbus(pmdev, &arg);
+}
+
+/*
+ * VOUT_MODE says how the VOUT_* commands encode voltages.  It's per
+ * page, and may be changed; so it's cached per page, and forgotten
+ * when it's written.  That needs tracking the current PAGE too.
+ */
+static struct pmbus_vout *pmbus_vout(struct pmbus_dev *pmdev)
+{
+	/* until we write PAGE, assume the power-on default */
+	return &pmdev->vout[pmdev->page < 0 ? 0 : pmdev->page];
+}
+
+static void pmbus_vout_set(struct pmbus_vout *vout, u8 mode)
+{
+	vout->mode = mode;
+	/* LINEAR16 exponent:  five bit two's complement */
+	vout->exponent = (s8) (mode << 3) >> 3;
+	vout->scale = ldexp(1.0, vout->exponent);
+	vout->valid = 1;
+}
+
+/* Keep track of state that writes change */
+static void pmbus_dev_wrote(struct pmbus_dev *pmdev, u16 cmd, u8 byte)
+{
+	switch (cmd) {
+	case PMB_PAGE:
+		pmdev->page = byte;
+		break;
+	case PMB_VOUT_MODE:
+		/* PAGE 0xff means all pages */
+		if (pmdev->page == 0xff)
+			memset(pmdev->vout, 0, sizeof pmdev->vout);
+		else
+			pmbus_vout(pmdev)->valid = 0;
+		break;
+	}
+}
+
+/* Returns zero, or negative errno. */
+static SHADDAP int pmbus_write_byte_data(struct pmbus_dev *pmdev, u16 cmd, u8 byte)
+{
+	struct i2c_smbus_ioctl_data	arg;
+	int				status;
+
+	/* use i2c; or WRITE_I2C_BLOCK_2: 2 byte cmd, 1 byte block;
+	 * or tweak params to SMBus "write word"
+	 */
+	if (is_pmb_extended(cmd))
+		return -ENOSYS;
+
+	if (!is_pmb_8bit(cmd))
+		return -EINVAL;
+
+	memset(&arg, 0, sizeof arg);
+	arg.read_write = I2C_SMBUS_WRITE;
+	arg.command = cmd;
+	arg.size = I2C_SMBUS_BYTE_DATA;
+	arg.data = (union i2c_smbus_data *) &byte;
+
+	status = pmbus_xfer_smbus(pmdev, &arg);
+	if (status == 0)
+		pmbus_dev_wrote(pmdev, cmd, byte);
+	return status;
+}
+
+/* Select a PAGE, skipping the write if it's already selected.  That
+ * assumes nobody else changes PAGE behind our back; if in doubt, forget
+ * it (set pmdev->page negative) first.  With "force", the driver we
+ * pushed aside may well change it, so the write is never skipped.
+ */
+static int pmbus_dev_set_page(struct pmbus_dev *pmdev, u8 page)
+{
+	int	status;
+
+	if (pmdev->force)
+		pmdev->page = -1;
+	if (pmdev->page == page)
+		return 0;
+	status = pmbus_write_byte_data(pmdev, PMB_PAGE, page);
+	if (status < 0)
+		pmdev->page = -1;	/* who knows, now */
+	return status;
+}
+
+/* Returns zero, or negative errno. */
+static SHADDAP int pmbus_write_word_data(struct pmbus_dev *pmdev, u16 cmd, u16 word)
+{
+	struct i2c_smbus_ioctl_data	arg;
+
+	/* use i2c; or WRITE_I2C_BLOCK_2: 2 byte cmd, 2 byte block */
+	if (is_pmb_extended(cmd))
+		return -ENOSYS;
+
+	if (!is_pmb_8bit(cmd))
+		return -EINVAL;
+
+	/* adapter code handles byteswapping if needed */
+	memset(&arg, 0, sizeof arg);
+	arg.read_write = I2C_SMBUS_WRITE;
+	arg.command = cmd;
+	arg.size = I2C_SMBUS_WORD_DATA;
+	arg.data = (union i2c_smbus_data *) &word;
+
+	return pmbus_xfer_smbus(pmdev, &arg);
+}
+
+/* Returns zero, or negative errno. */
+static SHADDAP int pmbus_write_block(struct pmbus_dev *pmdev, u16 cmd,
+		unsigned write_len, u8 *write_buf)
+{
+	struct i2c_smbus_ioctl_data	arg;
+	union i2c_smbus_data		data;
+	int				retval;
+
+	if (!write_buf || write_len == 0 || write_len > 255)
+		return -EINVAL;
+
+	/* use i2c; or WRITE_I2C_BLOCK_2: 2 byte cmd, N byte block */
+	if (is_pmb_extended(cmd))
+		return -ENOSYS;
+
+	if (!is_pmb_8bit(cmd))
+		return -EINVAL;
+
+	/* If there's no SMBus support, I2C might work (we did NOT ensure
+	 * there will be one or the other)
+	 */
+	if (!(pmdev->funcs & I2C_FUNC_SMBUS_WRITE_BLOCK_DATA)) {
+		retval = -EOPNOTSUPP;
+		goto try_i2c;
+	}
+	if (write_len > 32) {
+		retval = -EFBIG;
+		goto try_i2c;
+	}
+
+	data.block[0] = write_len;
+	memcpy(&data.block[1], write_buf, write_len);
+
+	memset(&arg, 0, sizeof arg);
+	arg.read_write = I2C_SMBUS_WRITE;
+	arg.command = cmd;
+	arg.size = I2C_SMBUS_BLOCK_DATA;
+	arg.data = &data;
+
+	return pmbus_xfer_smbus(pmdev, &arg);
+
+try_i2c:
+	/* PEC, if it's in use, is added here in userspace */
+	if (pmdev->funcs & I2C_FUNC_I2C) {
+		struct i2c_msg			msg;
+		struct i2c_rdwr_ioctl_data	msgdat;
+		u8				buf[2 + 255 + 1];
+
+		msgdat.msgs = &msg;
+		msgdat.nmsgs = 1;
+
+		msg.addr = pmdev->addr;
+		msg.flags = 0;
+		msg.len = 2 + write_len;
+		msg.buf = buf;
+
+		buf[0] = cmd;
+		buf[1] = write_len;
+		memcpy(&buf[2], write_buf, write_len);
+		if (pmdev->use_pec) {
+			buf[msg.len] = pmbus_pec(pmdev->addr,
+					buf, msg.len, NULL, 0);
+			msg.len++;
+		}
+
+		retval = pmbus_xfer_rdwr(pmdev, &msgdat);
+	}
+
+	return retval;
+}
+
+/*----------------------------------------------------------------------*/
+
+/* Call after setting m, b and R */
+static void pmbus_coefficients_prepare(struct pmbus_coefficients *c)
+{
+	double	d = 1.0;
+	int	r;
+
+	/* ideally:
+	 *   d = exp10((double)c->R);
+	 * but that, or pow(), can be unavailable
+	 */
+	for (r = c->R; r < 0; r++)
+		d /= 10.0;
+	for (r = c->R; r > 0; r--)
+		d *= 10.0;
+
+	c->exp10_R = d;
+	c->scale = 1.0 / (d * c->m);
+	c->offset = -(double)c->b / c->m;
+
+	/* keep Y * milli_mul within 64 bits, for any 16-bit Y */
+	c->milli_ok = c->m != 0 && c->R >= -11 && c->R <= 11;
+	if (c->milli_ok) {
+		long long p = 1;
+
+		for (r = c->R < 0 ? -c->R : c->R; r > 0; r--)
+			p *= 10;
+		if (c->R < 0) {
+			c->milli_mul = 1000 * p;
+			c->milli_off = 1000LL * c->b;
+			c->milli_div = c->m;
+		} else {
+			c->milli_mul = 1000;
+			c->milli_off = 1000LL * c->b * p;
+			c->milli_div = c->m * p;
+		}
+		/* rounding wants a positive divisor */
+		if (c->milli_div < 0) {
+			c->milli_mul = -c->milli_mul;
+			c->milli_off = -c->milli_off;
+			c->milli_div = -c->milli_div;
+		}
+	}
+	c->valid = 1;
+}
+
+static void
+coefficients(struct pmbus_dev *pmdev, const struct pmbus_cmd_desc *op, int read)
+{
+	union i2c_smbus_data		data;
+	int				status;
+	struct pmbus_coefficients	*c;
+
+	read = !!read;
+	c = pmdev->state[op->cmd].c + read;
+
+	/* This is specified as a block proc call, which is currently not
+	 * widely supported.  The I2C-level backup makes sure that many
+	 * more systems can use this call.
+	 *
+	 * NOTE as with QUERY, handling for "extended" commands is not
+	 * specified by PMBus 1.1 ...
+	 */
+	if (pmdev->funcs & I2C_FUNC_SMBUS_BLOCK_PROC_CALL) {
+		struct i2c_smbus_ioctl_data	arg;
+
+		data.block[0] = 2;
+		data.block[1] = op->cmd;
+		data.block[2] = read;
+
+		memset(&arg, 0, sizeof arg);
+		arg.read_write = I2C_SMBUS_WRITE;
+		arg.command = PMB_COEFFICIENTS;
+		arg.size = I2C_SMBUS_BLOCK_PROC_CALL;
+		arg.data = &data;
+
+		status = pmbus_xfer_smbus(pmdev, &arg);
+
+	/* PEC, if it's in use, is checked here in userspace */
+	} else if (pmdev->funcs & I2C_FUNC_I2C) {
+		struct i2c_msg			msg[2];
+		struct i2c_rdwr_ioctl_data	msgdat;
+		u8				wbuf[4];
+
+		msgdat.msgs = msg;
+		msgdat.nmsgs = 2;
+
+		msg[0].addr = msg[1].addr = pmdev->addr;
+
+		msg[0].flags = 0;
+		msg[0].len = 4;
+		msg[0].buf = wbuf;
+
+		wbuf[0] = PMB_COEFFICIENTS;
+		wbuf[1] = 2;
+		wbuf[2] = op->cmd;
+		wbuf[3] = read;
+
+		msg[1].flags = I2C_M_RD;
+		msg[1].len = 6 + !!pmdev->use_pec;
+		msg[1].buf = data.block;
+
+		status = pmbus_xfer_rdwr(pmdev, &msgdat);
+		if (status >= 0 && pmdev->use_pec
+				&& pmbus_pec(pmdev->addr, wbuf, 4,
+						data.block, 6) != data.block[6])
+			status = -EBADMSG;
+
+	} else
+		status = -EOPNOTSUPP;
+
+	if (status < 0)
+		return;
+
+	if (data.block[0] != 5)
+		return;
+
+	c->m = (data.block[2] << 8) | data.block[1];
+	c->b = (data.block[4] << 8) | data.block[3];
+	c->R = data.block[5];
+	pmbus_coefficients_prepare(c);
+}
+
+static void query_apply(struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_desc *op, u8 word);
+
+static void query(struct pmbus_dev *pmdev, const struct pmbus_cmd_desc *op)
+{
+	struct i2c_smbus_ioctl_data	arg;
+	u16				word;
+
+	/* NOTE query for "extended" commands is not specified by PMBus 1.1;
+	 * presumably that will just send a two byte block (which can't use
+	 * the portability tweak below).  Fortunately there's no evident
+	 * need to support such two-byte commands yet.
+	 */
+	if (op->cmd > 0xff)
+		return;
+
+	/* This is specified as a block proc call, which is currently not
+	 * widely supported.  Instead, implement this using normal proc
+	 * calls, which are more widely available.
+	 */
+	word = (op->cmd << 8) | 1;
+
+	memset(&arg, 0, sizeof arg);
+	arg.command = PMB_QUERY;
+	arg.size = I2C_SMBUS_PROC_CALL;
+	arg.data = (union i2c_smbus_data *) &word;
+
+	if (pmbus_xfer_smbus(pmdev, &arg) < 0 || (word & 0x00ff) != 1) {
+		/* REVISIT we _really_ want QUERY to work, so it'd be nice
+		 * to recover from transient faults here.  If we could tell
+		 * such faults from real ones, that is... instead of seeing
+		 * false EPERM reports for everything in the I2C stack.
+		 */
+		pmdev->no_query = 1;
+		return;
+	}
+
+	word >>= 8;
+
+	/* The FSP PSUs that I'm testing this on *really* need a delay here */
+	if (word & (1 << 7))
+		pmbus_xfer_holdoff(pmdev, 1000);
+
+	query_apply(pmdev, op, word);
+}
+
+/* Record what QUERY reported about "op", and whatever else we need to
+ * know before using it.
+ */
+static void query_apply(struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_desc *op, u8 word)
+{
+	pmdev->learned = 1;
+
+	/* query supported, but not this operation? */
+	if (!(word & (1 << 7))) {
+		pmdev->op[op->cmd] = &unsupported;
+		return;
+	}
+
+	pmdev->state[op->cmd].query = word;
+	pmdev->op[op->cmd] = op;
+
+	/* Try to get the coefficients for DIRECT format numbers */
+	if (((word >> 2) & 7) == 3 && pmdev->op[PMB_COEFFICIENTS]) {
+		if (word & (1 << 5))	/* read (always) */
+			coefficients(pmdev, op, 1);
+		if (word & (1 << 6))	/* write */
+			coefficients(pmdev, op, 0);
+	}
+
+	if (op->cmd == PMB_VOUT_MODE) {
+		/* VOUT_MODE is a special snowflake, its coefficients are
+		 * at least per-page, not per-command.
+		 */
+		int mode = pmbus_read_byte_data(pmdev, op->cmd);
+
+		if (mode >= 0)
+			pmbus_vout_set(pmbus_vout(pmdev), mode);
+		return;
+	}
+
+}
+
+/* Return:  negative = can't tell, 0 = no, 1 = yes */
+static int checksupport(struct pmbus_dev *pmdev, u16 cmd)
+{
+	const struct pmbus_cmd_desc *op;
+
+	/* NOTE:  no revision check.  QUERY is a PMBUS 1.1 addition,
+	 * but the device's PMBus revision may not be exposed.
+	 *
+	 * NOTE:  this assumes we can check prefixes for PMB_MFR_EXT(x)
+	 * and PMB_EXT(x) operations, even though we can't query those
+	 * operations directly...
+	 */
+	if (is_pmb_extended(cmd))
+		return -1;
+
+	/* maybe a profile told us */
+	if (pmdev->op[cmd])
+		return pmdev->op[cmd] != &unsupported;
+
+	if (pmdev->op[PMB_QUERY] == &unsupported || pmdev->no_query)
+		return -1;
+
+	/* DIRECT format values need COEFFICIENTS, if it's there */
+	if (cmd != PMB_COEFFICIENTS && !pmdev->op[PMB_COEFFICIENTS])
+		checksupport(pmdev, PMB_COEFFICIENTS);
+
+	op = pmbus_cmd_lookup(cmd);
+	if (op)
+		query(pmdev, op);
+
+	return pmdev->op[cmd] != &unsupported;
+}
+
+/*
+ * Rather than QUERY everything up front, each mode resolves support for
+ * just the commands it will touch.  With "-Q", the QUERY calls (process
+ * calls, same wire format as query() uses) are pipelined through I2C_RDWR
+ * where the adapter allows, PMBUS_BATCH_MAX per ioctl.  That's opt-in:
+ * some devices need the pause query() leaves after each one.
+ */
+
+/* Returns negative errno if the whole chunk failed; else words[i] holds
+ * what QUERY said, or negative if that didn't work.
+ */
+static int query_batch_chunk(struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_desc **ops, unsigned n, int *words)
+{
+	struct i2c_msg			msg[2 * PMBUS_BATCH_MAX];
+	struct i2c_rdwr_ioctl_data	msgdat;
+	u8				wbuf[PMBUS_BATCH_MAX][3];
+	u8				rbuf[PMBUS_BATCH_MAX][3];
+	unsigned			i;
+	int				status;
+
+	for (i = 0; i < n; i++) {
+		wbuf[i][0] = PMB_QUERY;
+		wbuf[i][1] = 1;
+		wbuf[i][2] = ops[i]->cmd;
+
+		msg[2 * i].addr = pmdev->addr;
+		msg[2 * i].flags = 0;
+		msg[2 * i].len = 3;
+		msg[2 * i].buf = wbuf[i];
+
+		msg[2 * i + 1].addr = pmdev->addr;
+		msg[2 * i + 1].flags = I2C_M_RD;
+		msg[2 * i + 1].len = 2 + !!pmdev->use_pec;
+		msg[2 * i + 1].buf = rbuf[i];
+	}
+
+	msgdat.msgs = msg;
+	msgdat.nmsgs = 2 * n;
+
+	status = pmbus_xfer_rdwr(pmdev, &msgdat);
+	if (status < 0)
+		return status;
+
+	for (i = 0; i < n; i++) {
+		if (rbuf[i][0] != 1)
+			words[i] = -EPROTO;
+		else if (pmdev->use_pec && pmbus_pec(pmdev->addr,
+					wbuf[i], 3, rbuf[i], 2) != rbuf[i][2])
+			words[i] = -EBADMSG;
+		else
+			words[i] = rbuf[i][1];
+	}
+	return 0;
+}
+
+/* Resolve support for all the commands "want" accepts (NULL = all) */
+static void pmbus_dev_resolve(struct pmbus_dev *pmdev,
+		bool (*want)(const struct pmbus_cmd_desc *op))
+{
+	const struct pmbus_cmd_desc	*op;
+	const struct pmbus_cmd_desc	*ops[256];
+	int				words[256];
+	bool				delay = false;
+	unsigned			i, n, chunk;
+
+	/* QUERY for DIRECT format commands needs COEFFICIENTS first */
+	checksupport(pmdev, PMB_COEFFICIENTS);
+	if (pmdev->op[PMB_QUERY] == &unsupported || pmdev->no_query)
+		return;
+
+	n = 0;
+	for_each_pmbus_op(op) {
+		if (pmdev->op[op->cmd])
+			continue;
+		if (!want || want(op))
+			ops[n++] = op;
+	}
+
+	for (i = 0; i < n; i++)
+		words[i] = -EOPNOTSUPP;
+	if (batch_query && (pmdev->funcs & I2C_FUNC_I2C)) {
+		for (i = 0; i < n; i += chunk) {
+			chunk = n - i;
+			if (chunk > PMBUS_BATCH_MAX)
+				chunk = PMBUS_BATCH_MAX;
+			query_batch_chunk(pmdev, ops + i, chunk, words + i);
+		}
+	}
+
+	/* query_apply() may read VOUT_MODE or COEFFICIENTS */
+	for (i = 0; i < n; i++) {
+		if (words[i] >= 0 && (words[i] & (1 << 7)))
+			delay = true;
+	}
+	if (delay)
+		pmbus_xfer_holdoff(pmdev, 1000);
+
+	for (i = 0; i < n && !pmdev->no_query; i++) {
+		if (words[i] >= 0)
+			query_apply(pmdev, ops[i], words[i]);
+		else
+			query(pmdev, ops[i]);
+	}
+}
+
+static bool want_p1(const struct pmbus_cmd_desc *op)
+{
+	return op->flags & FLG_SHOW_P1;
+}
+
+static bool want_status(const struct pmbus_cmd_desc *op)
+{
+	return op->flags & FLG_STATUS;
+}
+
+/* what pmbus_dev_show_values() shows */
+static bool want_value(const struct pmbus_cmd_desc *op)
+{
+	if (op->flags & (FLG_SHOW_P1|FLG_STATUS))
+		return false;
+	switch (op->type) {
+	case RW1:
+	case R1:
+	case RW2:
+	case R2:
+	case ENERGY:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* The strings that identify what kind of device this is */
+static const u16 pmbus_ident_cmds[4] = {
+	PMB_MFR_ID,
+	PMB_MFR_MODEL,
+	PMB_MFR_REVISION,
+	PMB_IC_DEVICE_ID,
+};
+
+static char *pmbus_read_string(struct pmbus_dev *pmdev, u16 cmd)
+{
+	u8 buf[256];
+	int status;
+	unsigned i;
+
+	/* maybe we already have it */
+	for (i = 0; i < 4; i++) {
+		if (pmbus_ident_cmds[i] == cmd && pmdev->ident[i])
+			return strdup(pmdev->ident[i]);
+	}
+
+	/* For non-queryable devices we'll still try to read inventory
+	 * data strings.  That should be harmless but informative.
+	 */
+	if (checksupport(pmdev, cmd) == 0)
+		return NULL;
+
+	memset(buf, 0, sizeof buf);
+	status = pmbus_read_block(pmdev, cmd, sizeof buf - 1, buf);
+	return (status > 0) ? strdup((void *)buf) : NULL;
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * Device profiles record what QUERY and COEFFICIENTS told us about a
+ * kind of device, so we needn't ask again:  that's a couple hundred
+ * process calls (each followed by a delay) for a fully queryable part.
+ * They're plain text, one item per line:
+ *
+ *	mfr_id ACME			identity strings (rest of line)
+ *	mfr_model PSU-1234
+ *	vout_mode 0x17
+ *	cmd 0x88 query=0xac read=1,0,2	QUERY data, READ coefficients
+ *	cmd 0x05 unsupported
+ *
+ * Profiles are cached per identity (MFR_ID, MFR_MODEL, MFR_REVISION
+ * and IC_DEVICE_ID) in $PMBUS_PEEK_CACHE, else in ~/.cache/pmbus_peek;
+ * "-N" bypasses the cache.  Commands the profile doesn't mention are
+ * still queried as needed, and anything learned that way is saved.
+ *
+ * "-P file" uses a given profile instead of the cache, which is how
+ * devices without QUERY (PMBus 1.0) can get DIRECT format decoding.
+ * "-D" dumps a profile, "-K file" compares one against the device.
+ */
+
+static const char *pmbus_ident_tags[4] = {
+	"mfr_id",
+	"mfr_model",
+	"mfr_revision",
+	"ic_device_id",
+};
+
+/* Read the identity strings, without QUERY (that's what we'd rather
+ * skip).  Like pmbus_read_string() with non-queryable devices, that
+ * might provoke a CML fault on devices lacking some of them.
+ */
+static void pmbus_dev_identify(struct pmbus_dev *pmdev)
+{
+	u8 buf[256];
+	int status;
+	unsigned i;
+	char *s;
+
+	for (i = 0; i < 4; i++) {
+		memset(buf, 0, sizeof buf);
+		status = pmbus_read_block(pmdev, pmbus_ident_cmds[i],
+				sizeof buf - 1, buf);
+		if (status <= 0)
+			continue;
+		/* one line, please */
+		for (s = (char *) buf; *s; s++) {
+			if (*s < ' ' || *s == 0x7f)
+				*s = '?';
+		}
+		pmdev->ident[i] = strdup((char *) buf);
+	}
+}
+
+static void pmbus_profile_write(struct pmbus_dev *pmdev, FILE *f)
+{
+	const struct pmbus_cmd_state	*st;
+	unsigned			i;
+
+	fprintf(f, "# pmbus_peek device profile\n");
+	for (i = 0; i < 4; i++) {
+		if (pmdev->ident[i])
+			fprintf(f, "%s %s\n", pmbus_ident_tags[i],
+					pmdev->ident[i]);
+	}
+
+	if (pmdev->op[PMB_VOUT_MODE] && pmdev->op[PMB_VOUT_MODE] != &unsupported
+			&& pmbus_vout(pmdev)->valid)
+		fprintf(f, "vout_mode 0x%02x\n", pmbus_vout(pmdev)->mode);
+
+	for (i = 0; i < 256; i++) {
+		if (!pmdev->op[i])
+			continue;
+		if (pmdev->op[i] == &unsupported) {
+			fprintf(f, "cmd 0x%02x unsupported\n", i);
+			continue;
+		}
+		st = &pmdev->state[i];
+		fprintf(f, "cmd 0x%02x query=0x%02x", i, st->query);
+		if (st->c[1].valid)
+			fprintf(f, " read=%d,%d,%d",
+					st->c[1].m, st->c[1].b, st->c[1].R);
+		if (st->c[0].valid)
+			fprintf(f, " write=%d,%d,%d",
+					st->c[0].m, st->c[0].b, st->c[0].R);
+		fprintf(f, "\n");
+	}
+}
+
+static int pmbus_parse_coefficients(const char *s, struct pmbus_coefficients *c)
+{
+	int m, b, R;
+
+	if (sscanf(s, "%d,%d,%d", &m, &b, &R) != 3)
+		return -EINVAL;
+	c->m = m;
+	c->b = b;
+	c->R = R;
+	pmbus_coefficients_prepare(c);
+	return 0;
+}
+
+/* Parse one "cmd ..." line (after the keyword) into the device state */
+static int pmbus_profile_cmd(struct pmbus_dev *pmdev, char *line)
+{
+	const struct pmbus_cmd_desc	*op;
+	struct pmbus_cmd_state		st;
+	char				*word, *save = NULL;
+	unsigned long			cmd;
+	bool				none = false;
+
+	word = strtok_r(line, " \t", &save);
+	if (!word)
+		return -EINVAL;
+	cmd = strtoul(word, NULL, 0);
+	op = pmbus_cmd_lookup(cmd);
+	if (cmd > 0xff || !op)
+		return -EINVAL;
+
+	memset(&st, 0, sizeof st);
+	while ((word = strtok_r(NULL, " \t", &save)) != NULL) {
+		if (strcmp(word, "unsupported") == 0)
+			none = true;
+		else if (strncmp(word, "query=", 6) == 0)
+			st.query = strtoul(word + 6, NULL, 0);
+		else if (strncmp(word, "read=", 5) == 0) {
+			if (pmbus_parse_coefficients(word + 5, &st.c[1]) < 0)
+				return -EINVAL;
+		} else if (strncmp(word, "write=", 6) == 0) {
+			if (pmbus_parse_coefficients(word + 6, &st.c[0]) < 0)
+				return -EINVAL;
+		} else
+			return -EINVAL;
+	}
+
+	if (none) {
+		pmdev->op[cmd] = &unsupported;
+		return 0;
+	}
+	pmdev->op[cmd] = op;
+	pmdev->state[cmd] = st;
+	return 0;
+}
+
+/* Apply a profile to the device.  With "check", the identity strings
+ * must all match the device's; returns -ESTALE if they don't.  Else
+ * the profile supplies any identity strings not yet known.
+ */
+static int pmbus_profile_read(struct pmbus_dev *pmdev, FILE *f, bool check)
+{
+	char		line[512];
+	unsigned	lineno = 0;
+	unsigned	i;
+
+	while (fgets(line, sizeof line, f)) {
+		char	*key = line, *value;
+		size_t	len = strlen(line);
+
+		lineno++;
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (!*key || *key == '#')
+			continue;
+
+		value = strchr(key, ' ');
+		if (value)
+			*value++ = '\0';
+		else
+			value = "";
+
+		for (i = 0; i < 4; i++) {
+			if (strcmp(key, pmbus_ident_tags[i]) != 0)
+				continue;
+			if (check) {
+				if (!pmdev->ident[i]
+					|| strcmp(pmdev->ident[i], value) != 0)
+					return -ESTALE;
+			} else if (!pmdev->ident[i])
+				pmdev->ident[i] = strdup(value);
+			break;
+		}
+		if (i < 4)
+			continue;
+
+		/* same VOUT_MODE on every page, until it's written */
+		if (strcmp(key, "vout_mode") == 0) {
+			for (i = 0; i < 256; i++)
+				pmbus_vout_set(&pmdev->vout[i],
+						strtoul(value, NULL, 0));
+		}
+		else if (strcmp(key, "cmd") != 0
+				|| pmbus_profile_cmd(pmdev, value) < 0) {
+			fprintf(stderr, "profile line %u: can't parse '%s'\n",
+					lineno, key);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/* Returns a malloc'd path to the profile for this device in "dir" (NULL
+ * for the cache directory), else NULL
+ */
+static char *pmbus_cache_path(struct pmbus_dev *pmdev, const char *dir,
+		bool mkdirs)
+{
+	const char	*home = getenv("HOME");
+	char		path[PATH_MAX];
+	size_t		len;
+	unsigned	i;
+	char		*s;
+
+	if (!pmdev->ident[0] && !pmdev->ident[1] && !pmdev->ident[3])
+		return NULL;
+
+	if (!dir)
+		dir = getenv("PMBUS_PEEK_CACHE");
+	if (dir)
+		len = snprintf(path, sizeof path, "%s/", dir);
+	else if (home)
+		len = snprintf(path, sizeof path, "%s/.cache/pmbus_peek/", home);
+	else
+		return NULL;
+	if (len >= sizeof path)
+		return NULL;
+
+	if (mkdirs) {
+		for (s = path + 1; *s; s++) {
+			if (*s != '/')
+				continue;
+			*s = '\0';
+			(void) mkdir(path, 0755);
+			*s = '/';
+		}
+	}
+
+	for (i = 0; i < 4 && len < sizeof path - 16; i++) {
+		for (s = pmdev->ident[i]; s && *s && len < sizeof path - 16;
+				s++) {
+			path[len++] = (isalnum((unsigned char) *s)
+					|| *s == '.' || *s == '-') ? *s : '_';
+		}
+		if (i < 3)
+			path[len++] = '+';
+	}
+	/* the length cap may have ended those loops early */
+	path[len] = '\0';
+	strcat(path, ".profile");
+	return strdup(path);
+}
+
+static void pmbus_cache_load(struct pmbus_dev *pmdev)
+{
+	char	*path = pmbus_cache_path(pmdev, NULL, false);
+	FILE	*f;
+	int	status;
+
+	if (!path)
+		return;
+	f = fopen(path, "r");
+	if (f) {
+		status = pmbus_profile_read(pmdev, f, true);
+		if (verbose)
+			fprintf(stderr, "%s cached profile %s\n",
+					status < 0 ? "Ignored" : "Loaded",
+					path);
+		/* forget everything a partial load may have set */
+		if (status < 0) {
+			memset(pmdev->op, 0, sizeof pmdev->op);
+			memset(pmdev->state, 0, sizeof pmdev->state);
+			memset(pmdev->vout, 0, sizeof pmdev->vout);
+		}
+		fclose(f);
+	}
+	free(path);
+}
+
+/* Profiles named by the user may be files, or directories holding
+ * profiles named by identity (as in the cache).  Returns a malloc'd
+ * path to the profile for this device, else NULL with errno set.
+ */
+static char *pmbus_profile_find(struct pmbus_dev *pmdev, const char *name)
+{
+	struct stat	st;
+	char		*path;
+
+	if (stat(name, &st) < 0)
+		return NULL;
+	if (!S_ISDIR(st.st_mode))
+		return strdup(name);
+
+	if (!pmdev->ident[0])
+		pmbus_dev_identify(pmdev);
+	path = pmbus_cache_path(pmdev, name, false);
+	if (!path)
+		errno = ENOENT;
+	return path;
+}
+
+static int pmbus_profile_load(struct pmbus_dev *pmdev, const char *path)
+{
+	FILE		*f;
+	int		status;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	status = pmbus_profile_read(pmdev, f, false);
+	fclose(f);
+	if (verbose && status == 0)
+		fprintf(stderr, "Loaded profile %s\n", path);
+	return status;
+}
+
+static bool pmbus_same_coefficients(const struct pmbus_coefficients *a,
+		const struct pmbus_coefficients *b)
+{
+	if (!a->valid || !b->valid)
+		return a->valid == b->valid;
+	return a->m == b->m && a->b == b->b && a->R == b->R;
+}
+
+/* Cross-validate a profile against what the device reports, returning
+ * how many things differ (or a negative errno).  That's a way to catch
+ * bugs in devices as well as in profiles.
+ */
+static int pmbus_profile_check(struct pmbus_dev *pmdev, const char *name)
+{
+	struct pmbus_dev		expect;
+	const struct pmbus_cmd_state	*want, *have;
+	unsigned			i;
+	int				status;
+	int				bad = 0;
+	char				*path;
+
+	if (!pmdev->ident[0])
+		pmbus_dev_identify(pmdev);
+	path = pmbus_profile_find(pmdev, name);
+	if (!path)
+		return -errno;
+
+	memset(&expect, 0, sizeof expect);
+	expect.page = -1;
+	status = pmbus_profile_load(&expect, path);
+	free(path);
+	if (status < 0) {
+		bad = status;
+		goto done;
+	}
+
+	for (i = 0; i < 4; i++) {
+		if (!expect.ident[i] || (pmdev->ident[i]
+				&& !strcmp(expect.ident[i], pmdev->ident[i])))
+			continue;
+		printf("%s: profile '%s', device '%s'\n",
+			pmbus_ident_tags[i],
+			expect.ident[i], pmdev->ident[i] ? : "");
+		bad++;
+	}
+
+	pmbus_dev_resolve(pmdev, NULL);
+	if (pmdev->no_query) {
+		printf("Device can't QUERY for supported commands\n");
+		bad = 1;
+		goto done;
+	}
+
+	if (pmbus_vout(&expect)->valid && (!pmbus_vout(pmdev)->valid
+			|| pmbus_vout(&expect)->mode != pmbus_vout(pmdev)->mode)) {
+		printf("vout_mode: profile %#04x, device %#04x\n",
+				pmbus_vout(&expect)->mode,
+				pmbus_vout(pmdev)->mode);
+		bad++;
+	}
+
+	for (i = 0; i < 256; i++) {
+		if (!expect.op[i] || !pmdev->op[i])
+			continue;
+		if ((expect.op[i] == &unsupported)
+				!= (pmdev->op[i] == &unsupported)) {
+			printf("%02x %-25s profile %s, device %s\n",
+				i, pmdev->op[i] == &unsupported
+					? expect.op[i]->tag : pmdev->op[i]->tag,
+				expect.op[i] == &unsupported
+					? "unsupported" : "supported",
+				pmdev->op[i] == &unsupported
+					? "unsupported" : "supported");
+			bad++;
+			continue;
+		}
+		if (pmdev->op[i] == &unsupported)
+			continue;
+
+		want = &expect.state[i];
+		have = &pmdev->state[i];
+		if (want->query != have->query) {
+			printf("%02x %-25s QUERY: profile %#04x, "
+					"device %#04x\n", i, pmdev->op[i]->tag,
+					want->query, have->query);
+			bad++;
+		}
+		if (!pmbus_same_coefficients(&want->c[1], &have->c[1])
+				|| !pmbus_same_coefficients(&want->c[0],
+					&have->c[0])) {
+			printf("%02x %-25s COEFFICIENTS differ\n",
+					i, pmdev->op[i]->tag);
+			bad++;
+		}
+	}
+
+	if (!bad)
+		printf("Profile matches device\n");
+done:
+	for (i = 0; i < 4; i++)
+		free(expect.ident[i]);
+	return bad;
+}
+
+static void pmbus_cache_save(struct pmbus_dev *pmdev)
+{
+	char	*path, *tmp;
+	FILE	*f;
+	int	fd;
+
+	if (!pmdev->learned || pmdev->no_query)
+		return;
+	path = pmbus_cache_path(pmdev, NULL, true);
+	if (!path)
+		return;
+
+	/* write it all, then replace the old one; the temporary file
+	 * must be unique, since "--scan-all" threads can save profiles
+	 * for the same kind of device at once
+	 */
+	tmp = malloc(strlen(path) + 8);
+	if (tmp) {
+		sprintf(tmp, "%s.XXXXXX", path);
+		fd = mkstemp(tmp);
+		f = (fd < 0) ? NULL : fdopen(fd, "w");
+		if (fd >= 0 && !f) {
+			close(fd);
+			unlink(tmp);
+		}
+		if (f) {
+			pmbus_profile_write(pmdev, f);
+			if (fclose(f) == 0 && rename(tmp, path) == 0) {
+				if (verbose)
+					fprintf(stderr, "Saved profile %s\n",
+							path);
+			} else
+				unlink(tmp);
+		}
+		free(tmp);
+	}
+	free(path);
+}
+
+/*----------------------------------------------------------------------*/
+
+static char *units(const struct pmbus_cmd_desc *op)
+{
+	switch (op->units) {
+	case VOLTS:
+		return "Volts";
+	case AMPERES:
+		return "Amperes";
+	case MILLISECONDS:
+		return "milliseconds";
+	case DEGREES_C:
+		return "degrees Celsius";
+	case WATTS:
+		return "Watts";
+	default:
+		return NULL;
+	}
+}
+
+/* for values in thousandths */
+static char *units_milli(const struct pmbus_cmd_desc *op)
+{
+	switch (op->units) {
+	case VOLTS:
+		return "millivolts";
+	case AMPERES:
+		return "milliamperes";
+	case MILLISECONDS:
+		return "microseconds";
+	case DEGREES_C:
+		return "millidegrees Celsius";
+	case WATTS:
+		return "milliwatts";
+	default:
+		return "thousandths";
+	}
+}
+
+
+/*----------------------------------------------------------------------*/
+
+static void pmbus_list_inventory(struct pmbus_dev *pmdev)
+{
+	char *mfr = pmbus_read_string(pmdev, PMB_MFR_ID);
+	char *model = pmbus_read_string(pmdev, PMB_MFR_MODEL);
+	char *revision = pmbus_read_string(pmdev, PMB_MFR_REVISION);
+	char *location = pmbus_read_string(pmdev, PMB_MFR_LOCATION);
+	char *date = pmbus_read_string(pmdev, PMB_MFR_DATE);
+	char *serial = pmbus_read_string(pmdev, PMB_MFR_SERIAL);
+	char *ic_device_id = pmbus_read_string(pmdev, PMB_IC_DEVICE_ID);
+	char *ic_device_rev = pmbus_read_string(pmdev, PMB_IC_DEVICE_REV);
+
+	if (!mfr && !model && !revision && !location && !date && !serial
+			&& !ic_device_id &&!ic_device_rev)
+		return;
+
+	/* REVISIT might be useful to fetch all these strings and save
+	 * them away.  They're the first handle we have on just what
+	 * kind of device we're working with...
+	 */
+
+	printf("Inventory Data:\n");
+	if (mfr) {
+		printf("  Manufacturer:\t\t%s\n", mfr);
+		free(mfr);
+	}
+	if (model) {
+		printf("  Model:\t\t%s\n", model);
+		free(model);
+	}
+	if (mfr) {
+		printf("  Revision:\t\t%s\n", revision);
+		free(revision);
+	}
+	if (location) {
+		printf("  Built at:\t\t%s\n", location);
+		free(location);
+	}
+	if (date) {
+		printf("  Built on:\t\t%s\n", date);
+		free(date);
+	}
+	if (serial) {
+		printf("  Serial:\t\t%s\n", serial);
+		free(serial);
+	}
+	if (ic_device_id) {
+		printf("  IC Device:\t\t%s\n", ic_device_id);
+		free(ic_device_id);
+	}
+	if (ic_device_rev) {
+		printf("  IC Device Revision:\t\t%s\n", ic_device_rev);
+		free(ic_device_rev);
+	}
+	printf("\n");
+}
+
+static void pmbus_dev_show_p1(struct pmbus_dev *pmdev)
+{
+	const char		*s0, *s1;
+
+	printf("PMBus slave on %s, address %#02x\n\n", pmdev->bus, pmdev->addr);
+
+	pmbus_dev_resolve(pmdev, want_p1);
+
+	pmbus_list_inventory(pmdev);
+
+	/*
+	 * NOTE spec bug:  table shows two four bit masks, which are
+	 * described as two fields, 3 bits 7-5 and 5 bits 4-0  ... in
+	 * fact part II probably deserves an extra bit.  Rev 1.0 of the
+	 * spec said the fields are 3 and 5 bits; let's be compatible.
+	 */
+	switch ((pmdev->revision >> 5) & 0x07) {
+	case 0:		s1 = "1.0"; break;
+	case 1:		s1 = "1.1"; break;
+	case 2:		s1 = "1.2"; break;
+	default:	s1 = "?"; break;
+	}
+	switch (pmdev->revision & 0x1f) {
+	case 0:		s0 = "1.0"; break;
+	case 1:		s0 = "1.1"; break;
+	case 2:		s0 = "1.2"; break;
+	default:	s0 = "?"; break;
+	}
+	printf("PMBus revisions (%#02x):\tpart I, ver %s; part II, ver %s\n",
+		pmdev->revision, s1, s0);
+
+	if (pmdev->capability & 0xf0) {
+		switch ((pmdev->capability >> 5) & 3) {
+		case 0:		s0 = "100 KHz"; break;
+		case 1:		s0 = "400 KHz"; break;
+		default:	s0 = "?speed?"; break;
+		}
+		printf("Capabilities (%#02x):\t%s%s%s\n",
+			pmdev->capability,
+			(pmdev->capability & (1 << 7)) ? "PEC, " : "",
+			(pmdev->capability & (1 << 4)) ? "SMBALERT#, ": "",
+			s0);
+	}
+	printf("\n");
+
+	if (checksupport(pmdev, PMB_APP_PROFILES) == 1) {
+		printf("Application Profiles:\n");
+
+		u8 buf[513];
+		int size = pmbus_read_block(pmdev, PMB_APP_PROFILES, sizeof(buf), buf);
+		for (int i = 0; size > 1 && i < size / 2; ++i) {
+			u8 profile_id = buf[2 * i];
+			u8 revision = buf[2 * i + 1];
+			if (profile_id == 0) {
+				printf(" No Application Profiles\n");
+			} else {
+				switch (profile_id) {
+				case 0:
+					/* handled above */
+					break;
+				case 1:
+					printf(" Server AC-DC Power Supply");
+					break;
+				case 2:
+					printf(" DC-DC Converters for Microprocessor Power and other Copmuter Applications");
+					break;
+				case 3:
+					printf(" DC-DC Converters for General-Purpose Use");
+					break;
+				default:
+					printf(" (reserved)");
+				}
+				printf(": rev %d.%d\n", (revision >> 4), (revision & 0xf));
+			}
+		}
+		printf("\n");
+	}
+
+	if (pmdev->no_query)
+		printf("Device can't QUERY for supported commands\n");
+}
+
+/*----------------------------------------------------------------------*/
+
+static void showbits(u16 mask, int i, char *bits[])
+{
+	int comma = 0;
+
+	while (i-- > 0) {
+		if (!(mask & (1 << i)))
+			continue;
+		printf("%s%s", comma++ ? ", " : "", bits[i] ? : "?");
+	}
+}
+
+void status_byte(struct pmbus_dev *pmdev, u16 cmd, char *label, char *bits[])
+{
+	int value;
+	int mode;
+
+	mode = checksupport(pmdev, cmd);
+	if (mode == 0)
+		return;
+	value = pmbus_read_byte_data(pmdev, cmd);
+	if (value < 0) {
+		if (mode == 1)
+			printf("  ** Device failed read of STATUS_%s?\n",
+					label);
+		return;
+	}
+	printf("  %-21s %02x: ", label, value);
+	showbits(value, 8, bits);
+	printf("\n");
+}
+
+static void show_status_vout(struct pmbus_dev *pmdev)
+{
+	static char *bits[8] = {
+		"VOUT Tracking Error",
+		"TOFF_MAX_WARNING",
+		"TON_MAX_FAULT",
+		"Attempted to exceed VOUT_MAX",
+		"Output Undervoltage Fault",
+		"Output Undervoltage Warning",
+		"Output Overvoltage Warning",
+		"Output Overvoltage Fault",
+	};
+
+	status_byte(pmdev, PMB_STATUS_VOUT, "VOUT", bits);
+}
+
+static void show_status_iout(struct pmbus_dev *pmdev)
+{
+	static char *bits[8] = {
+		"Output Overpower Warning",
+		"Output Overpower Fault",
+		"In Power Limiting Mode",
+		"Current Share Fault",
+		"Output Undercurrent Fault",
+		"Output Overcurrent Warning",
 		"Output Overcurrent and Low Voltage Fault",
 		"Output Overcurrent Fault",
 	};
 
-	status_byte(pmdev, PMB_STATUS_IOUT, "IOUT", bits);
+	status_byte(pmdev, PMB_STATUS_IOUT, "IOUT", bits);
+}
+
+static void show_status_input(struct pmbus_dev *pmdev)
+{
+	static char *bits[8] = {
+		"Input Overpower Warning",
+		"Input Overcurrent Warning",
+		"Input Overcurrent Fault",
+		"Unit Off for Insufficient Input Voltage",
+		"Input Undervoltage Fault",
+		"Input Undervoltage Warning",
+		"Input Overvoltage Warning",
+		"Input Overvoltage Fault",
+	};
+
+	status_byte(pmdev, PMB_STATUS_INPUT, "INPUT", bits);
+}
+
+static void show_status_mfr_specific(struct pmbus_dev *pmdev)
+{
+	static char *bits[8] = {
+		"mfr_status_0",
+		"mfr_status_1",
+		"mfr_status_2",
+		"mfr_status_3",
+		"mfr_status_4",
+		"mfr_status_5",
+		"mfr_status_6",
+		"mfr_status_7",
+	};
+
+	status_byte(pmdev, PMB_STATUS_MFR_SPECIFIC, "MFR_SPECIFIC", bits);
+}
+
+static void show_status_fans(struct pmbus_dev *pmdev)
+{
+	static char *bits1_2[8] = {
+		"airflow warning",
+		"airflow fault",
+		"fan 2 speed override",
+		"fan 1 speed override",
+		"fan 2 warning",
+		"fan 1 warning",
+		"fan 2 fault",
+		"fan 1 fault",
+	};
+	static char *bits3_4[8] = {
+		"(reserved)",
+		"(reserved)",
+		"fan 4 speed override",
+		"fan 3 speed override",
+		"fan 4 warning",
+		"fan 4 warning",
+		"fan 3 fault",
+		"fan 3 fault",
+	};
+
+	status_byte(pmdev, PMB_STATUS_FANS_1_2, "FANS_1_2", bits1_2);
+	status_byte(pmdev, PMB_STATUS_FANS_3_4, "FANS_3_4", bits3_4);
+}
+
+static void show_status_other(struct pmbus_dev *pmdev)
+{
+	static char *bits[8] = {
+		"(reserved)",
+		"Output OR-ing Device Fault",
+		"Input B OR-ing Device Fault",
+		"Input A OR-ing Device Fault",
+		"Input B Fuse or Circuit Breaker Fault",
+		"Input A Fuse or Circuit Breaker Fault",
+		"(reserved)",
+		"(reserved)",
+	};
+
+	status_byte(pmdev, PMB_STATUS_OTHER, "OTHER", bits);
+}
+
+static void show_status_temperature(struct pmbus_dev *pmdev)
+{
+	static char *bits[8] = {
+		"(reserved)",
+		"(reserved)",
+		"(reserved)",
+		"(reserved)",
+		"overtemp warning",
+		"overtemp fault",
+		"undertemp warning",
+		"undertemp fault",
+	};
+
+	status_byte(pmdev, PMB_STATUS_TEMPERATURE, "TEMPERATURE", bits);
+}
+
+static void show_status_cml(struct pmbus_dev *pmdev)
+{
+	static char *bits[8] = {
+		"other memory/logic fault",
+		"other comm fault",
+		"(reserved)",
+		"processor fault",
+		"memory fault",
+		"PEC",
+		"invalid data",
+		"invalid command",
+	};
+
+	status_byte(pmdev, PMB_STATUS_CML, "CML", bits);
+}
+
+static void pmbus_dev_show_status(struct pmbus_dev *pmdev)
+{
+	static char *bits[16] = {
+		"unspecified",
+		"comm/memory/logic",
+		"temperature",
+		"vin_underflow",
+		"iout_overflow",
+		"vout_overflow",
+		"off",
+		"busy",
+		"unknown",
+		"other",
+		"fan",
+		"power_good#",
+		"mfr",
+		"vin",
+		"iout",
+		"vout",
+	};
+
+	int value = -EINVAL;
+	int mode;
+
+	pmbus_dev_resolve(pmdev, want_status);
+
+	/* prefer full status word if it's available */
+	mode = checksupport(pmdev, PMB_STATUS_WORD);
+	if (mode != 0) {
+		value = pmbus_read_word_data(pmdev, PMB_STATUS_WORD);
+		if (mode == 1 && value < 0) {
+			printf("  ** Device failed read of STATUS_%s?\n",
+					"WORD");
+			return;
+		}
+		if (value >= 0)
+			printf("Status %04x: ", value);
+	}
+
+	/* else use status byte */
+	if (value < 0) {
+		mode = checksupport(pmdev, PMB_STATUS_BYTE);
+		if (mode != 0) {
+			value = pmbus_read_byte_data(pmdev,
+					PMB_STATUS_BYTE);
+			if (value < 0) {
+				if (mode == 1)
+					printf("  ** Device failed read"
+							"of STATUS_%s?\n",
+							"BYTE");
+				return;
+			}
+			printf("Status %02x: ", value);
+		}
+	}
+
+	showbits(value, 16, bits);
+	printf("\n");
+
+	if (value & ((1 << 15) | (1 << 5)))
+		show_status_vout(pmdev);
+	if (value & ((1 << 14) | (1 << 4)))
+		show_status_iout(pmdev);
+	if (value & ((1 << 13) | (1 << 3)))
+		show_status_input(pmdev);
+	if (value & (1 << 12))
+		show_status_mfr_specific(pmdev);
+
+	if (value & (1 << 10))
+		show_status_fans(pmdev);
+	if (value & (1 << 9))
+		show_status_other(pmdev);
+
+	if (value & (1 << 2))
+		show_status_temperature(pmdev);
+	if (value & (1 << 1))
+		show_status_cml(pmdev);
+
+	printf("\n");
+}
+
+/* Returns VOUT_MODE for the current page, or NULL if we can't know it */
+static const struct pmbus_vout *pmbus_vout_get(struct pmbus_dev *pmdev)
+{
+	struct pmbus_vout	*vout = pmbus_vout(pmdev);
+	int			mode;
+
+	if (vout->valid)
+		return vout;
+	if (checksupport(pmdev, PMB_VOUT_MODE) != 1)
+		return NULL;
+
+	mode = pmbus_read_byte_data(pmdev, PMB_VOUT_MODE);
+	if (mode < 0)
+		return NULL;
+	pmbus_vout_set(vout, mode);
+	return vout;
+}
+
+static bool vout_mode_is_linear(struct pmbus_dev *pmdev)
+{
+	const struct pmbus_vout *vout = pmbus_vout_get(pmdev);
+
+	return vout && !(vout->mode & 0xe0);
+}
+
+static inline double pmbus_convert_from_direct(const struct pmbus_cmd_state *st,
+		int value)
+{
+	/* DIRECT encoding:
+	 *  X = ((value * (10 ^ -R)) - b) / m
+	 */
+	return value * st->c[1].scale + st->c[1].offset;
+}
+
+/* VR12 VID codes:  5 mV steps from 250 mV; zero means off.
+ *
+ * REVISIT the VID code type (VOUT_MODE bits 4:0) is manufacturer
+ * specific; VR11, VR13 and so on should be selectable by profile.
+ */
+static double pmbus_vid_to_volts(u8 vid)
+{
+	return vid ? 0.25 + (vid - 1) * 0.005 : 0.0;
+}
+
+/* Decode a VOUT_MODE formatted value; returns false if we can't */
+static bool pmbus_vout_decode(struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_state *st, u16 value, double *volts)
+{
+	const struct pmbus_vout *vout = pmbus_vout_get(pmdev);
+
+	if (!vout)
+		return false;
+
+	switch (vout->mode >> 5) {
+	case 0:		/* LINEAR16:  unsigned mantissa */
+		*volts = value * vout->scale;
+		return true;
+	case 1:		/* VID */
+		*volts = pmbus_vid_to_volts(value);
+		return true;
+	case 2:		/* DIRECT, with this command's coefficients */
+		if (!st->c[1].valid)
+			return false;
+		*volts = pmbus_convert_from_direct(st, (s16) value);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+static void pmbus_dev_show_commands(struct pmbus_dev *pmdev)
+{
+	unsigned		i;
+	const struct pmbus_cmd_desc *op;
+	const struct pmbus_cmd_state *st;
+
+	pmbus_dev_resolve(pmdev, NULL);
+
+	printf("Supported Commands:\n");
+	for (i = 0; i < 255; i++) {
+		char			*format;
+		int			direct = 0;
+
+		op = pmdev->op[i];
+		if (op == &unsupported || !op)
+			continue;
+		st = &pmdev->state[op->cmd];
+
+		/* command inputs and outputs */
+		switch (op->type) {
+		case W0:
+			format = "nodata";
+			break;
+		case RW1:
+		case W1:
+		case R1:
+			format = "u8 (bitmask)";
+			break;
+		case RW2:
+		case R2:
+			if (op->flags == FLG_FORMAT_VOUT && vout_mode_is_linear(pmdev)) {
+				format = "x16 (VOUT_MODE)";
+				break;
+			}
+			switch ((st->query >> 2) & 7) {
+			case 0:
+				if (op->units == BITS)
+					format = "u16 (bitmask)";
+				else
+					format = "s16 (LINEAR)";
+				break;
+			case 3:
+				format = "s16 (DIRECT)";
+				direct = 1;
+				break;
+			case 5:
+				format = "u16 (VID)";
+				break;
+			case 6:
+				format = "x16 (MFR)";
+				break;
+			default:
+				format = "x16 (UNKNOWN)";
+				break;
+			}
+			break;
+		case RWB:
+		case RWB14:
+			format = "block";
+			break;
+		case RWP_QUERY:
+		case RWP_COEFF:
+			format = "process_call";
+			break;
+		case RWB_APP_PROFILE:
+			format = "(Application Profile)";
+			break;
+		case ENERGY:
+			switch ((st->query >> 2) & 7) {
+			case 0:
+				format = "block(6), Energy counter (LINEAR)";
+				break;
+			case 3:
+				format = "block(6), Energy counter (DIRECT)";
+				break;
+			default:
+				format = "block(6), Energy counter (UNKNOWN)";
+			}
+			break;
+		default:
+			format = "(UNKNOWN call syntax)";
+			break;
+		}
+
+		/* Now display it all */
+		printf("  %02x %-25s %c%c %s",
+			op->cmd, op->tag,
+			(st->query & (1 << 5)) ? 'r' : ' ',
+			(st->query & (1 << 6)) ? 'w' : ' ',
+			format);
+
+		format = units(op);
+		if (format == NULL && op->units == STRING)
+			format = "ISO 8859/1 string";
+		if (format)
+			printf(", %s", format);
+
+		printf("\n");
+
+		/* dump coefficients; "always" R, maybe W too */
+		if (direct && (st->c[1].valid || st->c[0].valid)) {
+			printf("     Coefficients: ");
+			if (st->c[1].valid)	/* Read */
+				printf("READ b=%d m=%d R=%d",
+					st->c[1].b, st->c[1].m, st->c[1].R);
+			else
+				printf("no READ coefficients?");
+			if (st->c[0].valid)	/* Write */
+				printf("; WRITE b=%d m=%d R=%d",
+					st->c[0].b, st->c[0].m, st->c[0].R);
+			printf("\n");
+		}
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * LINEAR11 format:  5-bit two's complement exponent N in the top bits,
+ * 11-bit two's complement mantissa Y below it; X = Y * 2^N.
+ *
+ * Raw telemetry logs can hold lots of these, so besides the scalar
+ * decoder there's one for arrays, using SIMD where the CPU has it.
+ * Both are exact:  Y and 2^N are exact in single precision, and so is
+ * their product.  "pmbus_peek -B" compares their speed.
+ */
+
+/* 2^e for small e, built directly so it's branch-free */
+static inline double pmbus_exp2i(int e)
+{
+	union {
+		u64	bits;
+		double	d;
+	} u;
+
+	u.bits = (u64) (1023 + e) << 52;
+	return u.d;
+}
+
+static inline double pmbus_linear11(u16 value)
+{
+	int	mantissa = (s16) (value << 5) >> 5;
+	int	exponent = (s16) value >> 11;
+
+	return mantissa * pmbus_exp2i(exponent);
+}
+
+static void linear11_array_scalar(const u16 *raw, float *out, size_t n)
+{
+	size_t	i;
+
+	for (i = 0; i < n; i++)
+		out[i] = pmbus_linear11(raw[i]);
+}
+
+#if defined(__SSE2__)
+/* eight words per step */
+static size_t linear11_array_sse2(const u16 *raw, float *out, size_t n)
+{
+	const __m128i	bias = _mm_set1_epi32(127);
+	size_t		i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i	v = _mm_loadu_si128((const __m128i *) (raw + i));
+		__m128i	m = _mm_srai_epi16(_mm_slli_epi16(v, 5), 5);
+		__m128i	e = _mm_srai_epi16(v, 11);
+		__m128i	mlo, mhi, elo, ehi;
+
+		/* sign extend to 32 bits */
+		mlo = _mm_srai_epi32(_mm_unpacklo_epi16(m, m), 16);
+		mhi = _mm_srai_epi32(_mm_unpackhi_epi16(m, m), 16);
+		elo = _mm_srai_epi32(_mm_unpacklo_epi16(e, e), 16);
+		ehi = _mm_srai_epi32(_mm_unpackhi_epi16(e, e), 16);
+
+		/* 2^e is just a float exponent field */
+		elo = _mm_slli_epi32(_mm_add_epi32(elo, bias), 23);
+		ehi = _mm_slli_epi32(_mm_add_epi32(ehi, bias), 23);
+
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(mlo),
+					_mm_castsi128_ps(elo)));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(mhi),
+					_mm_castsi128_ps(ehi)));
+	}
+	return i;
+}
+#endif
+
+#if defined(HAVE_AVX2_TARGET)
+/* sixteen words per step */
+__attribute__((target("avx2")))
+static size_t linear11_array_avx2(const u16 *raw, float *out, size_t n)
+{
+	const __m256i	bias = _mm256_set1_epi32(127);
+	size_t		i;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m256i	v = _mm256_loadu_si256((const __m256i *) (raw + i));
+		__m256i	m = _mm256_srai_epi16(_mm256_slli_epi16(v, 5), 5);
+		__m256i	e = _mm256_srai_epi16(v, 11);
+		__m256i	mlo, mhi, elo, ehi;
+
+		mlo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(m));
+		mhi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(m, 1));
+		elo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(e));
+		ehi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(e, 1));
+
+		elo = _mm256_slli_epi32(_mm256_add_epi32(elo, bias), 23);
+		ehi = _mm256_slli_epi32(_mm256_add_epi32(ehi, bias), 23);
+
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(
+				_mm256_cvtepi32_ps(mlo),
+				_mm256_castsi256_ps(elo)));
+		_mm256_storeu_ps(out + i + 8, _mm256_mul_ps(
+				_mm256_cvtepi32_ps(mhi),
+				_mm256_castsi256_ps(ehi)));
+	}
+	return i;
+}
+#endif
+
+#if defined(__ARM_NEON)
+/* eight words per step */
+static size_t linear11_array_neon(const u16 *raw, float *out, size_t n)
+{
+	const int32x4_t	bias = vdupq_n_s32(127);
+	size_t		i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		int16x8_t	v = vreinterpretq_s16_u16(vld1q_u16(raw + i));
+		int16x8_t	m = vshrq_n_s16(vshlq_n_s16(v, 5), 5);
+		int16x8_t	e = vshrq_n_s16(v, 11);
+		int32x4_t	elo, ehi;
+
+		elo = vshlq_n_s32(vaddq_s32(vmovl_s16(vget_low_s16(e)),
+					bias), 23);
+		ehi = vshlq_n_s32(vaddq_s32(vmovl_s16(vget_high_s16(e)),
+					bias), 23);
+
+		vst1q_f32(out + i, vmulq_f32(
+				vcvtq_f32_s32(vmovl_s16(vget_low_s16(m))),
+				vreinterpretq_f32_s32(elo)));
+		vst1q_f32(out + i + 4, vmulq_f32(
+				vcvtq_f32_s32(vmovl_s16(vget_high_s16(m))),
+				vreinterpretq_f32_s32(ehi)));
+	}
+	return i;
+}
+#endif
+
+/* Decode "n" LINEAR11 words, with the best SIMD code this CPU has */
+static void pmbus_linear11_array(const u16 *raw, float *out, size_t n)
+{
+	size_t	done = 0;
+
+#if defined(HAVE_AVX2_TARGET)
+	if (__builtin_cpu_supports("avx2"))
+		done = linear11_array_avx2(raw, out, n);
+#endif
+#if defined(__SSE2__)
+	done += linear11_array_sse2(raw + done, out + done, n - done);
+#elif defined(__ARM_NEON)
+	done += linear11_array_neon(raw + done, out + done, n - done);
+#endif
+	linear11_array_scalar(raw + done, out + done, n - done);
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * Integer-only decoding, in thousandths of the value's units (millivolts
+ * and so on, as with the hwmon ABI), for CPUs without fast floating
+ * point.  "-M" uses these instead of the double precision decoders;
+ * results are rounded to nearest.
+ */
+
+/* n / d, rounded to nearest (halves away from zero, like llround);
+ * d > 0.  Raw data has random signs, so don't branch on them.
+ */
+static inline long long div_round(long long n, long long d)
+{
+	long long sign = n >> 63;
+
+	return ((((n ^ sign) - sign) + d / 2) / d ^ sign) - sign;
+}
+
+/* 1000 * Y * 2^N, rounded likewise; also without branches */
+static inline long long milli_shift(long long y, int n)
+{
+	long long	sign = y >> 63;
+	int		left = n & ~(n >> 31);
+	int		right = left - n;
+
+	y = ((y ^ sign) - sign) * 1000 << left;
+	y = (y + ((1LL << right) >> 1)) >> right;
+	return (y ^ sign) - sign;
+}
+
+static inline long long pmbus_linear11_milli(u16 value)
+{
+	return milli_shift((s16) (value << 5) >> 5, (s16) value >> 11);
+}
+
+static inline long long pmbus_direct_milli(const struct pmbus_coefficients *c,
+		int value)
+{
+	if (!c->milli_ok)
+		return llround((value * c->scale + c->offset) * 1000.0);
+	return div_round(value * c->milli_mul - c->milli_off, c->milli_div);
+}
+
+static void linear11_array_milli(const u16 *raw, long long *out, size_t n)
+{
+	size_t	i;
+
+	for (i = 0; i < n; i++)
+		out[i] = pmbus_linear11_milli(raw[i]);
+}
+
+/* VOUT_MODE formatted values, as pmbus_vout_decode() */
+static bool pmbus_vout_decode_milli(struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_state *st, u16 value, long long *mv)
+{
+	const struct pmbus_vout *vout = pmbus_vout_get(pmdev);
+
+	if (!vout)
+		return false;
+
+	switch (vout->mode >> 5) {
+	case 0:		/* LINEAR16:  unsigned mantissa */
+		*mv = milli_shift(value, vout->exponent);
+		return true;
+	case 1:		/* VID, VR12 */
+		*mv = value ? 250 + (value - 1) * 5 : 0;
+		return true;
+	case 2:		/* DIRECT, with this command's coefficients */
+		if (!st->c[1].valid)
+			return false;
+		*mv = pmbus_direct_milli(&st->c[1], (s16) value);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * LINEAR11 has only 64K encodings, so "-T" decodes through tables built
+ * on first use (a few hundred microseconds).  Each is 256 KBytes, which
+ * won't fit in small caches; "-B" shows whether lookups beat the
+ * arithmetic, for random data and for the few distinct values typical
+ * of telemetry.
+ */
+
+static float	*linear11_lut;
+static int	*linear11_milli_lut;
+
+/* marks thousandths too big for an int */
+#define LUT_MILLI_BIG	INT_MIN
+
+/* daemon workers may decode concurrently, so build each table once */
+static pthread_once_t	linear11_lut_once = PTHREAD_ONCE_INIT;
+static pthread_once_t	linear11_milli_lut_once = PTHREAD_ONCE_INIT;
+
+static void pmbus_linear11_lut_init(void)
+{
+	float		*lut;
+	unsigned	i;
+
+	lut = malloc(0x10000 * sizeof *lut);
+	if (!lut)
+		return;
+	for (i = 0; i < 0x10000; i++)
+		lut[i] = pmbus_linear11(i);
+	linear11_lut = lut;
+}
+
+static const float *pmbus_linear11_lut(void)
+{
+	pthread_once(&linear11_lut_once, pmbus_linear11_lut_init);
+	return linear11_lut;
+}
+
+static void pmbus_linear11_milli_lut_init(void)
+{
+	int		*lut;
+	unsigned	i;
+	long long	mx;
+
+	lut = malloc(0x10000 * sizeof *lut);
+	if (!lut)
+		return;
+	for (i = 0; i < 0x10000; i++) {
+		mx = pmbus_linear11_milli(i);
+		lut[i] = (mx > INT_MAX || mx <= INT_MIN) ? LUT_MILLI_BIG : mx;
+	}
+	linear11_milli_lut = lut;
+}
+
+static const int *pmbus_linear11_milli_lut(void)
+{
+	pthread_once(&linear11_milli_lut_once, pmbus_linear11_milli_lut_init);
+	return linear11_milli_lut;
+}
+
+static inline double pmbus_linear11_lookup(u16 value)
+{
+	const float *lut = use_lut ? pmbus_linear11_lut() : NULL;
+
+	return lut ? lut[value] : pmbus_linear11(value);
+}
+
+static inline long long pmbus_linear11_milli_lookup(u16 value)
+{
+	const int *lut = use_lut ? pmbus_linear11_milli_lut() : NULL;
+
+	if (!lut || lut[value] == LUT_MILLI_BIG)
+		return pmbus_linear11_milli(value);
+	return lut[value];
+}
+
+/* Array decoders for tables, like pmbus_linear11_array() */
+static void linear11_array_lut(const u16 *raw, float *out, size_t n)
+{
+	const float	*lut = pmbus_linear11_lut();
+	size_t		i;
+
+	if (!lut) {
+		pmbus_linear11_array(raw, out, n);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		out[i] = lut[raw[i]];
+}
+
+static void linear11_array_milli_lut(const u16 *raw, long long *out, size_t n)
+{
+	const int	*lut = pmbus_linear11_milli_lut();
+	size_t		i;
+
+	if (!lut) {
+		linear11_array_milli(raw, out, n);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		out[i] = lut[raw[i]];
+		if (out[i] == LUT_MILLI_BIG)
+			out[i] = pmbus_linear11_milli(raw[i]);
+	}
+}
+
+/*----------------------------------------------------------------------*/
+
+/* Decode a numeric word value, per its QUERY format (or VOUT_MODE).
+ * Returns false for non-numeric values, or ones we can't decode.
+ */
+static bool pmbus_decode(struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_desc *op, u16 value, double *x)
+{
+	const struct pmbus_cmd_state *st = &pmdev->state[op->cmd];
+
+	if (op->flags == FLG_FORMAT_VOUT
+			&& pmbus_vout_decode(pmdev, st, value, x))
+		return true;
+
+	switch ((st->query >> 2) & 7) {
+	case 0:
+		if (op->units == BITS)
+			return false;
+		*x = pmbus_linear11_lookup(value);
+		return true;
+	case 3:
+		*x = pmbus_convert_from_direct(st, (s16) value);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Same, in thousandths */
+static bool pmbus_decode_milli(struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_desc *op, u16 value, long long *x)
+{
+	const struct pmbus_cmd_state *st = &pmdev->state[op->cmd];
+
+	if (op->flags == FLG_FORMAT_VOUT
+			&& pmbus_vout_decode_milli(pmdev, st, value, x))
+		return true;
+
+	switch ((st->query >> 2) & 7) {
+	case 0:
+		if (op->units == BITS)
+			return false;
+		*x = pmbus_linear11_milli_lookup(value);
+		return true;
+	case 3:
+		*x = pmbus_direct_milli(&st->c[1], (s16) value);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Fetch supported byte and word values, in batches; just the ones
+ * "want" accepts, unless it's NULL.  Unfetched values[] are -ENODATA.
+ * If "ns" is given, it gets when each value was read (CLOCK_MONOTONIC).
+ */
+static void pmbus_dev_read_values(struct pmbus_dev *pmdev, int values[256],
+		u64 *ns, bool (*want)(const struct pmbus_cmd_desc *op))
+{
+	unsigned		i, n;
+	const struct pmbus_cmd_desc *op;
+	struct pmbus_batch_req	req[256];
+
+	for (i = n = 0; i < 256; i++) {
+		values[i] = -ENODATA;
+		op = pmdev->op[i];
+		if (op == &unsupported || !op)
+			continue;
+		if (want && !want(op))
+			continue;
+
+		switch (op->type) {
+		case RW1:
+		case R1:
+			req[n].len = 1;
+			break;
+		case RW2:
+		case R2:
+			req[n].len = 2;
+			break;
+		default:
+			continue;
+		}
+		req[n++].cmd = op->cmd;
+	}
+	pmbus_read_batch(pmdev, req, n);
+	for (i = 0; i < n; i++) {
+		values[req[i].cmd] = req[i].value;
+		if (ns)
+			ns[req[i].cmd] = req[i].ns;
+	}
+}
+
+static void pmbus_dev_show_values(struct pmbus_dev *pmdev)
+{
+	unsigned		i;
+	const struct pmbus_cmd_desc *op;
+	const struct pmbus_cmd_state *st;
+	int			values[256];
+	double			x;
+	long long		mx;
+	bool			scaled;
+
+	pmbus_dev_resolve(pmdev, want_value);
+
+	/* fetch all the byte and word values up front */
+	pmbus_dev_read_values(pmdev, values, NULL, want_value);
+
+	printf("Attribute Values:\n");
+	for (i = 0; i < 255; i++) {
+		int		value;
+		const char	*name;
+
+		op = pmdev->op[i];
+		if (op == &unsupported || !op)
+			continue;
+		st = &pmdev->state[op->cmd];
+		if (op->flags & (FLG_SHOW_P1|FLG_STATUS))
+			continue;
+
+		name = op->tag;
+		scaled = false;
+		if (strncmp(name, "read_", 5) == 0)
+			name += 5;
+
+		/* read and display values, where that's meaningful */
+		switch (op->type) {
+		case W0:
+		case W1:
+		case RWP_QUERY:
+		case RWP_COEFF:
+		default:
+			/* write-only or magic */
+			continue;
+		case RW1:
+		case R1:
+			value = values[op->cmd];
+			if (value < 0) {
+				printf("  %-21s [ERROR reading]", name);
+				continue;
+			}
+			printf("  %-21s %02x: ", name, value);
+/* FIXME need per-op (bitmask) decoders... */
+			printf("(BITMAP)");
+			printf("\n");
+			continue;
+		case RW2:
+		case R2:
+			value = values[op->cmd];
+			if (value < 0) {
+				/* FIXME display a diagnostic */
+				continue;
+			}
+			printf("  %-21s %04x: ", name, value);
+			if (milli && pmbus_decode_milli(pmdev, op, value, &mx)) {
+				printf("%lld", mx);
+				scaled = true;
+				break;
+			}
+			if (!milli && pmbus_decode(pmdev, op, value, &x)) {
+				printf("%g", x);
+				break;
+			}
+			switch ((st->query >> 2) & 7) {
+			case 0:
+				printf("(BITMAP)");
+				break;
+			case 1:
+				/* 16-bit unsigned */
+				printf("%d", value);
+				break;
+			case 4:
+				/* 8-bit unsigned */
+				printf("%d", value & 0xff);
+				break;
+			case 5:
+				printf("u16 (VID)");
+				break;
+			case 6:
+				printf("manufacturer specific");
+				break;
+			default:
+				printf("unknown format");
+				break;
+			}
+			break;
+
+		case ENERGY: {
+			u8 buf[6] = {0,};
+			int size = pmbus_read_block_without_checking(pmdev, op->cmd, 6, 6, buf);
+			u16 accumulator = (buf[1] << 8) + buf[0];
+			u8 rollovers = buf[2];
+			unsigned int samples = (buf[5] << 16) + (buf[4] << 8) + buf[3];
+			printf("  %-21s %02x%02x%02x%02x%02x%02x: ", name, buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+			switch ((st->query >> 2) & 7) {
+			case 0: {
+				/* linear format */
+				const int max_value = ((2 << 9) - 1) * (2 << 14); /* ((2^10) - 1) * 2^15 == 33521664 */
+				double energy_count = rollovers * max_value + accumulator;
+				printf("%g", energy_count);
+				}
+				break;
+			case 3: {
+				/* direct mode */
+				double energy_count;
+				const int y_max = ((2 << 14) - 1); /* (2^15) - 1 == 32767 */
+				double max_value = (double)(st->c[1].m * y_max + st->c[1].b)
+						* st->c[1].exp10_R;
+				energy_count = rollovers * max_value + pmbus_convert_from_direct(st, accumulator);
+				printf("%g", energy_count);
+				//printf(" [coeffs: m = %d, b = %d, R = %d]", st->c[1].m, st->c[1].b, st->c[1].R);
+				}
+				break;
+			default:
+				printf("(error: QUERY 0x%02x)", st->query);
+			}
+			}
+			break;
+#if 0
+//	RWB,		/* read/write block (up to 255 bytes) */
+//	RWB14,		/* read/write block (of 14 bytes) */
+		case RWB:
+		case RWB14:
+			format = "block";
+#endif
+			break;
+		}
+
+		name = scaled ? units_milli(op) : units(op);
+		if (name)
+			printf(" %s", name);
+		printf("\n");
+	}
+	printf("\n");
+}
+
+static void pmbus_dev_show(struct pmbus_dev *pmdev, bool values, bool cmds)
+{
+	pmbus_dev_show_p1(pmdev);
+	if (values) {
+		pmbus_dev_show_status(pmdev);
+		pmbus_dev_show_values(pmdev);
+	}
+	if (cmds)
+		pmbus_dev_show_commands(pmdev);
+}
+
+/* For machine readers:  raw hex value, then for numeric values the
+ * decoded value and its units.  Read errors show as "ERROR".
+ */
+static void pmbus_fprint_value(FILE *f, struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_desc *op, int value)
+{
+	const char	*u = NULL;
+	double		x;
+	long long	mx;
+
+	if (value < 0)
+		fprintf(f, " ERROR");
+	else if (op->type == R1 || op->type == RW1)
+		fprintf(f, " %02x", value);
+	else {
+		fprintf(f, " %04x", value);
+		if (milli && pmbus_decode_milli(pmdev, op, value, &mx)) {
+			fprintf(f, " %lld", mx);
+			u = units_milli(op);
+		} else if (!milli && pmbus_decode(pmdev, op, value, &x)) {
+			fprintf(f, " %g", x);
+			u = units(op);
+		}
+		if (u)
+			fprintf(f, " %s", u);
+	}
+	fprintf(f, "\n");
+}
+
+/*----------------------------------------------------------------------*/
+
+static void pmbus_clear_fault(struct pmbus_dev *pmdev)
+{
+	/* if we know we can't clear faults, don't try */
+	if (checksupport(pmdev, PMB_CLEAR_FAULT) != 0)
+		(void) smbus_write_byte(pmdev, PMB_CLEAR_FAULT);
+}
+
+/*----------------------------------------------------------------------*/
+
+static int pmbus_dev_scan(struct pmbus_dev *pmdev)
+{
+	int			status;
+
+	/* SMBus (hence PMBus) devices must always ack their addresses.  */
+	if (pmdev->funcs & I2C_FUNC_SMBUS_QUICK) {
+		status = pmbus_quick(pmdev);
+		if (status < 0) {
+			fprintf(stderr, "No device present? error %d\n",
+					status);
+			return status;
+		}
+	}
+
+	/* QUERY lets us see what operations this device supports, which is
+	 * the most interesting information available without product docs.
+	 *
+	 * It also lets us avoid making calls we know will fail, which is
+	 * polite since such failures will trigger host notification or
+	 * SMBALERT# on some devices.  If we can't query, we'll just hope
+	 * those mechanisms aren't in use.
+	 *
+	 * Devices we've seen before needn't be asked all over again; and
+	 * a profile can stand in for QUERY on devices without it.
+	 */
+	if (profile_path) {
+		char *path = pmbus_profile_find(pmdev, profile_path);
+
+		status = path ? pmbus_profile_load(pmdev, path) : -errno;
+		free(path);
+		if (status < 0) {
+			fprintf(stderr, "%s: can't load profile: %s\n",
+					profile_path, strerror(-status));
+			return status;
+		}
+	} else if (use_cache) {
+		pmbus_dev_identify(pmdev);
+		pmbus_cache_load(pmdev);
+	}
+	checksupport(pmdev, PMB_QUERY);
+
+	if (checksupport(pmdev, PMB_CAPABILITY) != 0) {
+		status = pmbus_read_byte_data(pmdev, PMB_CAPABILITY);
+		if (status < 0) {
+			if (verbose)
+				fprintf(stderr, "No PMBus capability support; "
+					"assuming no PEC, etc\n");
+		} else {
+			pmdev->capability = status;
+
+			/* enable PEC if the device supports it */
+			if ((status & (1 << 7)) && pmdev->want_pec) {
+				if (pmbus_xfer_pec(pmdev, 1) < 0)
+					fprintf(stderr, "couldn't "
+						"enable PEC\n");
+				else
+					pmdev->use_pec = 1;
+			}
+		}
+	}
+
+	/* PMBus 1.0 has PMBUS_REVISION too; it's not new to PMBus 1.1 */
+	if (checksupport(pmdev, PMB_PMBUS_REVISION) != 0) {
+		status = pmbus_read_byte_data(pmdev, PMB_PMBUS_REVISION);
+		if (status < 0) {
+			if (verbose)
+				fprintf(stderr, "No PMBUS_REVISION support; "
+					"assuming 1.0\n");
+		} else
+			pmdev->revision = status;
+	}
+
+	/*
+	 * We may not find out anything about the device in the code above;
+	 * PMBUS 1.1 conformant devices only need to implement ONE command
+	 * that's not manufacturer-specific.
+	 *
+	 * Part definition files ("profiles", see pmbus_profile_write) help
+	 * there.  They represent what we can query from fully dynamic
+	 * PMBus 1.1 devices ("-D" dumps that), are looked up by product
+	 * ID strings for PMBus 1.0 devices that may expose little more
+	 * than those strings and some sensor/control attributes, and can
+	 * be cross-validated against a device ("-K").  Merging works too:
+	 * whatever a profile says wins over what the device would report,
+	 * e.g. coefficients from docs rather than by protocol requests.
+	 *
+	 * REVISIT profiles should also be able to describe things like
+	 * manufacturer specific commands, format of user data, accuracy,
+	 * how the various controls and sensors work in the local
+	 * environment, what "pages" exist (and what each one does), and
+	 * so on.
+	 *
+	 * Doing all that usefully depends on having a variety of PMBus
+	 * based products running Linux.  At this writing there aren't
+	 * very many of them, although some recent Dell rackmount servers
+	 * are described as having PMBus support.
+	 */
+
+	return 0;
+}
+
+/*----------------------------------------------------------------------*/
+
+static const unsigned long i2c_func_pmbus_min
+		= I2C_FUNC_SMBUS_BYTE_DATA
+		| I2C_FUNC_SMBUS_WORD_DATA
+		| I2C_FUNC_SMBUS_PROC_CALL;
+
+/* SMBUS 2.0 table 4 lists reserved addresses */
+static bool pmbus_addr_reserved(long addr)
+{
+	return addr < 0x09 || addr > 0x77 || addr == 0x0c || addr == 0x28
+			|| addr == 0x37 || addr == 0x61;
+}
+
+/* Returns a device address, or negative after reporting why not */
+static int pmbus_parse_addr(const char *str)
+{
+	char	*tail;
+	long	addr;
+
+	addr = strtol(str, &tail, 0);
+	if (*str == '\0' || *tail || addr < 0) {
+		fprintf(stderr, "'%s' is not a device address\n", str);
+		return -1;
+	}
+
+	if (pmbus_addr_reserved(addr)) {
+		fprintf(stderr, "%#02lx' is a reserved device address\n",
+				addr);
+		return -1;
+	}
+	return addr;
+}
+
+/* Shared bus handles are left for their owner to close */
+static void pmbus_dev_close(struct pmbus_dev *pmdev)
+{
+	if (!pmdev->shared)
+		pmdev->xport->close(pmdev);
+}
+
+/*
+ * Set up a handle for the specified device on its bus.  Returns zero,
+ * else negative after reporting the problem.
+ *
+ * If "share" is another device's handle on the same bus, and that one
+ * addresses each message itself, the bus handle is shared rather than
+ * opened again.  The owner must be closed last.
+ */
+static int pmbus_dev_open(struct pmbus_dev *pmdev, char *adapter,
+		u8 addr, bool force, const struct pmbus_dev *share)
+{
+	int	status;
+
+	memset(pmdev, 0, sizeof *pmdev);
+	pmdev->fd = -1;
+	pmdev->page = -1;
+	if (share && share->rdwr_addr) {
+		pmdev->xport = share->xport;
+		pmdev->xport_data = share->xport_data;
+		pmdev->fd = share->fd;
+		pmdev->funcs = share->funcs;
+		pmdev->shared = 1;
+	} else {
+		pmdev->xport = pmbus_transport_for(adapter);
+		status = pmdev->xport->open(pmdev, adapter);
+		if (status < 0) {
+			fprintf(stderr, "%s: %s\n", adapter, strerror(-status));
+			fprintf(stderr, "Couldn't connect to I2C bus %s\n",
+					adapter);
+			return status;
+		}
+	}
+	pmdev->bus = adapter;
+
+	/* Trying for portability here.  We want to support all core PMBus
+	 * features.  Minimal SMBus support is almost good enough ... except
+	 * for block read/write and block proc calls.  So we insist on I2C
+	 * where the SMBus support is weak, and if it's available we also use
+	 * it to cope with the annoying "refuse to do 33+ byte blocks" limit.
+	 *
+	 * NOTE: WRITE_BLOCK isn't currently used -- or required -- so the
+	 * pmbus_block_write() method might fail on some systems.  If that
+	 * matters in your usage, add another test ...
+	 */
+	if ((pmdev->funcs & i2c_func_pmbus_min) != i2c_func_pmbus_min
+			|| !(pmdev->funcs & (I2C_FUNC_SMBUS_READ_BLOCK_DATA
+						| I2C_FUNC_I2C))
+			|| !(pmdev->funcs & (I2C_FUNC_SMBUS_BLOCK_PROC_CALL
+						| I2C_FUNC_I2C))
+			) {
+		fprintf(stderr, "%s: Funcs don't support PMBus\n", adapter);
+		status = -EOPNOTSUPP;
+		goto fail;
+	}
+
+	/* some adapter drivers don't support PEC */
+	pmdev->want_pec = enable_pec;
+	if (!(pmdev->funcs & I2C_FUNC_SMBUS_PEC) && pmdev->want_pec) {
+		fprintf(stderr, "%s: No PEC support\n", adapter);
+		pmdev->want_pec = 0;
+	}
+
+	/* Given I2C, transfers name the device themselves.  I2C_RDWR won't
+	 * notice a driver owning the address though; binding once, here,
+	 * still checks that.
+	 */
+	pmdev->rdwr_addr = !!(pmdev->funcs & I2C_FUNC_I2C);
+	status = pmdev->xport->set_addr(pmdev, addr, force);
+	if (status < 0) {
+		fprintf(stderr, "%s: %s\n", adapter, strerror(-status));
+		fprintf(stderr, "Couldn't %sattach to device %#02x\n",
+				force ? "force " : "", addr);
+		goto fail;
+	}
+	pmdev->addr = addr;
+	pmdev->force = force;
+	return 0;
+
+fail:
+	pmbus_dev_close(pmdev);
+	return status;
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * Periodic timers for polling.  Each is a timerfd on an absolute
+ * CLOCK_MONOTONIC schedule, so deadlines stay at start + k * period no
+ * matter how long each poll takes:  no cumulative drift.  An epoll loop
+ * runs whichever timers are due.  Jitter is how late a handler starts
+ * after its deadline; deadlines that pass while the loop is busy are
+ * counted as missed, not made up.
+ */
+struct pmbus_timer {
+	int		fd;
+	u64		start_ns;	/* first deadline */
+	u64		period_ns;
+	u64		ticks;		/* deadlines passed */
+	u64		missed;
+	u64		runs;
+	u64		jitter_ns;	/* latest */
+	u64		jitter_max_ns;
+	u64		jitter_sum_ns;
+	void		(*fn)(struct pmbus_timer *t);
+	void		*data;
+};
+
+static int pmbus_timer_start(struct pmbus_timer *t, int epfd,
+		u64 start_ns, u64 period_ns)
+{
+	struct itimerspec	its;
+	struct epoll_event	ev = { .events = EPOLLIN, .data.ptr = t, };
+	int			status;
+
+	t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (t->fd < 0)
+		return -errno;
+	t->start_ns = start_ns;
+	t->period_ns = period_ns;
+	pmbus_ns_to_timespec(start_ns, &its.it_value);
+	pmbus_ns_to_timespec(period_ns, &its.it_interval);
+	if (timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0
+			|| epoll_ctl(epfd, EPOLL_CTL_ADD, t->fd, &ev) < 0) {
+		status = -errno;
+		close(t->fd);
+		t->fd = -1;
+		return status;
+	}
+	return 0;
+}
+
+static void pmbus_timer_fire(struct pmbus_timer *t)
+{
+	u64	n, deadline;
+
+	/* a count of deadlines passed since the last read */
+	if (read(t->fd, &n, sizeof n) != sizeof n || n == 0)
+		return;
+	t->ticks += n;
+	t->missed += n - 1;
+
+	deadline = t->start_ns + (t->ticks - 1) * t->period_ns;
+	t->jitter_ns = pmbus_now_ns() - deadline;
+	if (t->jitter_ns > t->jitter_max_ns)
+		t->jitter_max_ns = t->jitter_ns;
+	t->jitter_sum_ns += t->jitter_ns;
+	t->runs++;
+
+	t->fn(t);
+}
+
+/* Run timers until *stop gets set (by a signal handler) */
+static int pmbus_timer_loop(int epfd, volatile sig_atomic_t *stop)
+{
+	struct epoll_event	ev[16];
+	int			i, n;
+
+	while (!*stop) {
+		n = epoll_wait(epfd, ev, 16, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		for (i = 0; i < n; i++)
+			pmbus_timer_fire(ev[i].data.ptr);
+	}
+	return 0;
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * Per-bus workers.  Transactions on one adapter must be serialized, but
+ * separate adapters can run in parallel; so each bus gets one thread,
+ * fed by a queue that any thread can add to without locking.  That's
+ * the intrusive MPSC queue from Dmitry Vyukov:  producers just swap
+ * themselves in at the head, and the lone consumer walks from the tail.
+ * An eventfd wakes the worker when there's something to do.
+ *
+ * Each work item runs fn() on the worker, then its completion callback
+ * done() gets fn()'s status.  An item with no fn() stops the worker.
+ */
+struct pmbus_work {
+	struct pmbus_work * _Atomic next;
+	int			(*fn)(struct pmbus_work *w);
+	void			(*done)(struct pmbus_work *w, int status);
+};
+
+struct pmbus_worker {
+	struct pmbus_work * _Atomic head;	/* newest; producers */
+	struct pmbus_work	*tail;		/* oldest; consumer only */
+	struct pmbus_work	stub;
+	int			efd;
+	pthread_t		thread;
+};
+
+static void pmbus_worker_push(struct pmbus_worker *wk, struct pmbus_work *w)
+{
+	struct pmbus_work	*prev;
+
+	atomic_store_explicit(&w->next, NULL, memory_order_relaxed);
+	prev = atomic_exchange_explicit(&wk->head, w, memory_order_acq_rel);
+	atomic_store_explicit(&prev->next, w, memory_order_release);
+}
+
+/* Returns the oldest item, or NULL if there's none (or a push hasn't
+ * quite finished; its eventfd write will come along soon)
+ */
+static struct pmbus_work *pmbus_worker_pop(struct pmbus_worker *wk)
+{
+	struct pmbus_work	*tail = wk->tail;
+	struct pmbus_work	*next;
+
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if (tail == &wk->stub) {
+		if (!next)
+			return NULL;
+		wk->tail = tail = next;
+		next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	}
+	if (next) {
+		wk->tail = next;
+		return tail;
+	}
+	if (tail != atomic_load_explicit(&wk->head, memory_order_acquire))
+		return NULL;
+
+	/* the last item needs something behind it before it can go */
+	pmbus_worker_push(wk, &wk->stub);
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if (!next)
+		return NULL;
+	wk->tail = next;
+	return tail;
+}
+
+/* Called from any thread */
+static void pmbus_worker_queue(struct pmbus_worker *wk, struct pmbus_work *w)
+{
+	u64	one = 1;
+
+	pmbus_worker_push(wk, w);
+	if (write(wk->efd, &one, sizeof one) != sizeof one)
+		perror("worker eventfd");
+}
+
+static void *pmbus_worker_main(void *arg)
+{
+	struct pmbus_worker	*wk = arg;
+	struct pmbus_work	*w;
+	u64			n;
+	int			status;
+
+	for (;;) {
+		if (read(wk->efd, &n, sizeof n) < 0 && errno != EINTR)
+			break;
+		while ((w = pmbus_worker_pop(wk)) != NULL) {
+			if (!w->fn)
+				return NULL;
+			status = w->fn(w);
+			if (w->done)
+				w->done(w, status);
+		}
+	}
+	return NULL;
+}
+
+static int pmbus_worker_start(struct pmbus_worker *wk)
+{
+	int	status;
+
+	atomic_store(&wk->stub.next, NULL);
+	atomic_store(&wk->head, &wk->stub);
+	wk->tail = &wk->stub;
+	wk->efd = eventfd(0, EFD_CLOEXEC);
+	if (wk->efd < 0)
+		return -errno;
+	status = pthread_create(&wk->thread, NULL, pmbus_worker_main, wk);
+	if (status) {
+		close(wk->efd);
+		wk->efd = -1;
+		return -status;
+	}
+	return 0;
+}
+
+/* Finish whatever's queued, then stop */
+static void pmbus_worker_stop(struct pmbus_worker *wk)
+{
+	struct pmbus_work	stop = { };
+
+	if (wk->efd < 0)
+		return;
+	pmbus_worker_queue(wk, &stop);
+	pthread_join(wk->thread, NULL);
+	close(wk->efd);
+	wk->efd = -1;
+}
+
+/*----------------------------------------------------------------------*/
+
+/*
+ * Daemon mode ("--daemon CONFIG"):  open and scan each configured device
+ * once, then keep polling them, publishing the latest values in a state
+ * file per device.  Monitoring clients read those files; they never touch
+ * the bus or wait for it, and discovery isn't repeated for every sample.
+ * The daemon stays in the foreground until SIGINT or SIGTERM.
+ *
+ * Attributes are polled by class (see pmbus_cmd_desc.poll), each with
+ * its own period:  limits and such rarely change, so rereading them
+ * every second would waste most of the bus traffic.  A value that can't
+ * be reread is still reported until it's older than its class's TTL;
+ * after that it shows as an error, even if the page couldn't be selected.
+ *
+ * The config file is line oriented, '#' starts a comment:
+ *
+ *   fast 1 [TTL]		seconds between polls of status, VOUT etc
+ *				(default 1; TTL defaults to 3 periods,
+ *				each device's own)
+ *   slow 10 [TTL]		... of temperatures, fans etc (default 10)
+ *   static 3600 [TTL]		... of limits etc (default 3600)
+ *   interval 1			same as "fast"
+ *				(periods are at least 1 msec)
+ *   state /run/pmbus_peek	directory for state files (default ".")
+ *   bus BUS [khz N] [util PERCENT]
+ *   device BUS ADDR [page N] [force] [fast|slow|static|interval SECONDS]
+ *
+ * A device may be listed once per page.  Its pages are polled together,
+ * on one schedule (the shortest periods listed for it), with each poll
+ * reading everything due on a page before moving to the next; so each
+ * page costs at most one PAGE write per poll, and one page alone none.
+ *
+ * Polls are paced so each bus stays below some utilisation (default 50%),
+ * leaving room for other masters and for drivers sharing the adapter.
+ * Wire time for each poll is estimated from its byte count, PEC and the
+ * bus clock.  The clock defaults to the slowest that any of the bus's
+ * devices claims in CAPABILITY.  Fast polls always run; slow and static
+ * ones wait while the bus is over budget, but no longer than a period.
+ * Polls are staggered so they don't all start at once.
+ *
+ * BUS is as for "-b".  A state file is named for its bus, address and
+ * page, e.g. "i2c-3-0x58-p1.values", and is replaced atomically after
+ * each poll.  It starts with:
+ *
+ *   time 1700000000		seconds since the epoch
+ *   monotonic 5012.250131	seconds, per CLOCK_MONOTONIC
+ *   bus_util_pct 3.1		estimated, since the daemon started
+ *   jitter_usec fast 41 950 52.7  poll start delay:  latest, max, average
+ *   missed fast 0		polls skipped because we fell behind
+ *   deferred fast 0		polls put off to spare the bus
+ *
+ * (jitter, missed and deferred lines repeat for each class).  Each bus
+ * has a worker thread doing its polls, so slow buses don't hold up the
+ * others; the main thread just runs the timers.  Then there's a line
+ * per attribute:  tag, when it was read (monotonic, so rates computed
+ * from successive values are accurate), raw hex value, and for numeric
+ * values the decoded value and its units.  Read errors show as "ERROR".
+ * VOUT_MODE formatted values are left raw while the page is unknown.
+ */
+static bool want_poll_static(const struct pmbus_cmd_desc *op)
+{
+	return op->poll == POLL_STATIC;
+}
+
+static bool want_poll_slow(const struct pmbus_cmd_desc *op)
+{
+	return op->poll == POLL_SLOW;
+}
+
+static bool want_poll_fast(const struct pmbus_cmd_desc *op)
+{
+	return op->poll == POLL_FAST;
+}
+
+/* Shorter periods could round to zero nanoseconds, and a zero timerfd
+ * interval means "fire just once"
+ */
+#define POLL_PERIOD_MIN		0.001	/* seconds */
+
+static struct pmbus_poll_class {
+	const char	*name;
+	bool		(*want)(const struct pmbus_cmd_desc *op);
+	double		period;		/* seconds */
+	double		ttl;		/* seconds; zero = 3 periods */
+} pmbus_poll_class[POLL_CLASSES] = {
+	[POLL_STATIC] = { "static", want_poll_static, 3600, },
+	[POLL_SLOW] = { "slow", want_poll_slow, 10, },
+	[POLL_FAST] = { "fast", want_poll_fast, 1, },
+};
+
+struct pmbus_poll_bus {
+	char			*name;
+	unsigned		khz;		/* zero = per CAPABILITY */
+	double			util;		/* fraction of wire time */
+	unsigned		ndevs;
+	u64			start_ns;
+	u64			free_ns;	/* budget is spent until then */
+	u64			wire_ns;	/* total, for statistics */
+	struct pmbus_worker	worker;
+};
+
+/* What a timer asks of the bus worker:  poll one class of values */
+struct pmbus_poll_req {
+	struct pmbus_work	work;
+	struct pmbus_poll_dev	*pdev;
+	int			cls;
+	atomic_bool		busy;		/* queued or running */
+
+	/* the main thread keeps the device's timers; their stats as of
+	 * queuing this, for the state file
+	 */
+	struct pmbus_timer	timer[POLL_CLASSES];
+};
+
+/* One PAGE of a polled device:  its latest values, and when they were read */
+struct pmbus_poll_page {
+	int			page;		/* to select, or negative */
+	char			*state_path;
+	int			values[256];
+	u64			ns[256];
+};
+
+struct pmbus_poll_dev {
+	struct pmbus_dev	dev;
+	struct pmbus_poll_page	*pages;
+	unsigned		npages;
+	double			period[POLL_CLASSES];	/* zero = default */
+	u64			ttl_ns[POLL_CLASSES];
+	struct pmbus_timer	timer[POLL_CLASSES];
+
+	/* bus pacing, by the bus worker */
+	unsigned		bus;		/* index, while configuring */
+	struct pmbus_poll_bus	*pbus;
+	struct pmbus_poll_req	req[POLL_CLASSES];
+	const struct pmbus_timer *stats;	/* req[].timer being polled */
+	u64			wire_ns[POLL_CLASSES];	/* estimated */
+	bool			pending[POLL_CLASSES];
+	u64			deferred[POLL_CLASSES];
+};
+
+struct pmbus_daemon {
+	char			*state_dir;
+	struct pmbus_poll_dev	*pdev;
+	unsigned		npdev;
+	struct pmbus_poll_bus	*pbus;
+	unsigned		npbus;
+};
+
+static volatile sig_atomic_t pmbus_daemon_stop;
+
+static void pmbus_daemon_signal(int sig)
+{
+	pmbus_daemon_stop = 1;
 }
 
-static void show_status_input(struct pmbus_dev *pmdev)
+/* Bus clock per CAPABILITY bits 6:5; 1 MHz is new in PMBus 1.3 */
+static unsigned pmbus_dev_khz(const struct pmbus_dev *pmdev)
 {
-	static char *bits[8] = {
-		"Input Overpower Warning",
-		"Input Overcurrent Warning",
-		"Input Overcurrent Fault",
-		"Unit Off for Insufficient Input Voltage",
-		"Input Undervoltage Fault",
-		"Input Undervoltage Warning",
-		"Input Overvoltage Warning",
-		"Input Overvoltage Fault",
-	};
+	switch ((pmdev->capability >> 5) & 3) {
+	case 1:
+		return 400;
+	case 2:
+		return 1000;
+	default:
+		return 100;
+	}
+}
 
-	status_byte(pmdev, PMB_STATUS_INPUT, "INPUT", bits);
+/*
+ * Wire time for an SMBus transaction moving "nbytes" bytes, counting the
+ * address bytes and any PEC:  nine clocks per byte (with ACK/NAK), and
+ * about one each for START, repeated START (if "rd") and STOP.
+ */
+static u64 pmbus_wire_ns(unsigned khz, unsigned nbytes, bool rd)
+{
+	return (nbytes * 9ULL + 2 + rd) * 1000000ULL / khz;
 }
 
-static void show_status_mfr_specific(struct pmbus_dev *pmdev)
+/* Estimated wire time to poll one class of values (all, if negative) */
+static u64 pmbus_poll_wire_ns(const struct pmbus_poll_dev *pdev, int cls,
+		unsigned khz)
 {
-	static char *bits[8] = {
-		"mfr_status_0",
-		"mfr_status_1",
-		"mfr_status_2",
-		"mfr_status_3",
-		"mfr_status_4",
-		"mfr_status_5",
-		"mfr_status_6",
-		"mfr_status_7",
-	};
+	const struct pmbus_dev		*pmdev = &pdev->dev;
+	const struct pmbus_cmd_desc	*op;
+	unsigned			i, pec = !!pmdev->use_pec;
+	u64				ns = 0;
 
-	status_byte(pmdev, PMB_STATUS_MFR_SPECIFIC, "MFR_SPECIFIC", bits);
+	for (i = 0; i < 256; i++) {
+		op = pmdev->op[i];
+		if (!op || op == &unsupported)
+			continue;
+		if (cls >= 0 && !pmbus_poll_class[cls].want(op))
+			continue;
+		switch (op->type) {
+		case RW1:
+		case R1:
+			ns += pmbus_wire_ns(khz, 4 + pec, true);
+			break;
+		case RW2:
+		case R2:
+			ns += pmbus_wire_ns(khz, 5 + pec, true);
+			break;
+		}
+	}
+	ns *= pdev->npages;
+	if (pdev->npages > 1)
+		ns += pdev->npages * pmbus_wire_ns(khz, 3 + pec, false);
+	return ns;
 }
 
-static void show_status_fans(struct pmbus_dev *pmdev)
+/*
+ * Account for "wire_ns" on the bus.  The budget runs at "util" seconds
+ * of wire time per second; polls that must run may overdraw it, others
+ * are refused until the bus is back in budget.
+ */
+static bool pmbus_bus_admit(struct pmbus_poll_bus *pbus, u64 wire_ns,
+		bool must)
 {
-	static char *bits1_2[8] = {
-		"airflow warning",
-		"airflow fault",
-		"fan 2 speed override",
-		"fan 1 speed override",
-		"fan 2 warning",
-		"fan 1 warning",
-		"fan 2 fault",
-		"fan 1 fault",
-	};
-	static char *bits3_4[8] = {
-		"(reserved)",
-		"(reserved)",
-		"fan 4 speed override",
-		"fan 3 speed override",
-		"fan 4 warning",
-		"fan 4 warning",
-		"fan 3 fault",
-		"fan 3 fault",
-	};
+	u64	now = pmbus_now_ns();
 
-	status_byte(pmdev, PMB_STATUS_FANS_1_2, "FANS_1_2", bits1_2);
-	status_byte(pmdev, PMB_STATUS_FANS_3_4, "FANS_3_4", bits3_4);
+	if (pbus->free_ns < now)
+		pbus->free_ns = now;
+	else if (!must)
+		return false;
+	pbus->free_ns += wire_ns / pbus->util;
+	pbus->wire_ns += wire_ns;
+	return true;
 }
 
-static void show_status_other(struct pmbus_dev *pmdev)
+static char *pmbus_state_path(const char *dir, const char *bus,
+		u8 addr, int page)
 {
-	static char *bits[8] = {
-		"(reserved)",
-		"Output OR-ing Device Fault",
-		"Input B OR-ing Device Fault",
-		"Input A OR-ing Device Fault",
-		"Input B Fuse or Circuit Breaker Fault",
-		"Input A Fuse or Circuit Breaker Fault",
-		"(reserved)",
-		"(reserved)",
-	};
+	const char	*name = strrchr(bus, '/');
+	char		*path, *s;
+	size_t		len;
+
+	name = name ? name + 1 : bus;
+	len = strlen(dir) + strlen(name) + 32;
+	path = malloc(len);
+	if (!path)
+		return NULL;
+	s = path + snprintf(path, len, "%s/", dir);
+	snprintf(s, len - (s - path), page < 0 ? "%s-%#02x" : "%s-%#02x-p%d",
+			name, addr, page);
+
+	/* "sim:format=direct" and such make poor file names */
+	for (; *s; s++) {
+		if (!isalnum((unsigned char) *s) && *s != '-' && *s != '.')
+			*s = '_';
+	}
+	strcat(path, ".values");
+	return path;
+}
 
-	status_byte(pmdev, PMB_STATUS_OTHER, "OTHER", bits);
+/* One line per attribute; see the comment above.  Decoding VOUT_MODE
+ * formatted values needs the device on their page, else "raw_vout".
+ */
+static void pmbus_dev_poll_write(struct pmbus_dev *pmdev,
+		const int values[256], const u64 ns[256], bool raw_vout,
+		FILE *f)
+{
+	unsigned			i;
+	const struct pmbus_cmd_desc	*op;
+
+	for (i = 0; i < 256; i++) {
+		op = pmdev->op[i];
+		if (!op || op == &unsupported || values[i] == -ENODATA)
+			continue;
+
+		fprintf(f, "%s %.6f", op->tag, ns[i] / 1e9);
+		if (raw_vout && op->flags == FLG_FORMAT_VOUT && values[i] >= 0)
+			fprintf(f, " %04x\n", values[i]);
+		else
+			pmbus_fprint_value(f, pmdev, op, values[i]);
+	}
 }
 
-static void show_status_temperature(struct pmbus_dev *pmdev)
+static double pmbus_bus_util(const struct pmbus_poll_bus *pbus)
 {
-	static char *bits[8] = {
-		"(reserved)",
-		"(reserved)",
-		"(reserved)",
-		"(reserved)",
-		"overtemp warning",
-		"overtemp fault",
-		"undertemp warning",
-		"undertemp fault",
-	};
+	u64	elapsed = pmbus_now_ns() - pbus->start_ns;
 
-	status_byte(pmdev, PMB_STATUS_TEMPERATURE, "TEMPERATURE", bits);
+	return elapsed ? (double) pbus->wire_ns / elapsed : 0;
 }
 
-static void show_status_cml(struct pmbus_dev *pmdev)
+static int pmbus_dev_poll_save(struct pmbus_poll_dev *pdev,
+		const struct pmbus_poll_page *pg)
 {
-	static char *bits[8] = {
-		"other memory/logic fault",
-		"other comm fault",
-		"(reserved)",
-		"processor fault",
-		"memory fault",
-		"PEC",
-		"invalid data",
-		"invalid command",
-	};
+	const struct pmbus_timer *t;
+	unsigned		i;
+	char			*tmp;
+	FILE			*f;
+	int			status;
 
-	status_byte(pmdev, PMB_STATUS_CML, "CML", bits);
+	/* write it all, then replace the old one */
+	tmp = malloc(strlen(pg->state_path) + 16);
+	if (!tmp)
+		return -ENOMEM;
+	sprintf(tmp, "%s.%d", pg->state_path, (int) getpid());
+	f = fopen(tmp, "w");
+	if (!f) {
+		status = -errno;
+		free(tmp);
+		return status;
+	}
+	fprintf(f, "time %ld\n", (long) time(NULL));
+	fprintf(f, "monotonic %.6f\n", pmbus_now_ns() / 1e9);
+	fprintf(f, "bus_util_pct %.1f\n", pmbus_bus_util(pdev->pbus) * 100);
+	for (i = 0; i < POLL_CLASSES; i++) {
+		t = &pdev->stats[i];
+		fprintf(f, "jitter_usec %s %.0f %.0f %.1f\n",
+				pmbus_poll_class[i].name,
+				t->jitter_ns / 1e3, t->jitter_max_ns / 1e3,
+				t->jitter_sum_ns / 1e3 / (t->runs ? t->runs : 1));
+		fprintf(f, "missed %s %llu\n", pmbus_poll_class[i].name,
+				(unsigned long long) t->missed);
+		fprintf(f, "deferred %s %llu\n", pmbus_poll_class[i].name,
+				(unsigned long long) pdev->deferred[i]);
+	}
+	/* after a failed PAGE write, pmbus_vout() would pick the wrong
+	 * page's VOUT_MODE, or even read it from the wrong page
+	 */
+	pmbus_dev_poll_write(&pdev->dev, pg->values, pg->ns,
+			pg->page >= 0 && pdev->dev.page != pg->page, f);
+	if (fclose(f) == 0 && rename(tmp, pg->state_path) == 0)
+		status = 0;
+	else {
+		status = -errno;
+		unlink(tmp);
+	}
+	free(tmp);
+	return status;
 }
 
-static void pmbus_dev_show_status(struct pmbus_dev *pmdev)
+/* Reread one class of values (or all, if cls is negative) on the
+ * current page, counting the reads that worked and those that didn't.
+ */
+static void pmbus_dev_poll_read(struct pmbus_poll_dev *pdev,
+		struct pmbus_poll_page *pg, int cls,
+		unsigned *good, unsigned *bad)
 {
-	static char *bits[16] = {
-		"unspecified",
-		"comm/memory/logic",
-		"temperature",
-		"vin_underflow",
-		"iout_overflow",
-		"vout_overflow",
-		"off",
-		"busy",
-		"unknown",
-		"other",
-		"fan",
-		"power_good#",
-		"mfr",
-		"vin",
-		"iout",
-		"vout",
-	};
+	struct pmbus_dev	*pmdev = &pdev->dev;
+	int			values[256];
+	u64			ns[256];
+	unsigned		i;
 
-	int value = -EINVAL;
-	int mode;
+	pmbus_dev_read_values(pmdev, values, ns,
+			cls < 0 ? NULL : pmbus_poll_class[cls].want);
 
-	/* prefer full status word if it's available */
-	mode = checksupport(pmdev, PMB_STATUS_WORD);
-	if (mode != 0) {
-		value = pmbus_read_word_data(pmdev->fd, PMB_STATUS_WORD);
-		if (mode == 1 && value < 0) {
-			printf("  ** Device failed read of STATUS_%s?\n",
-					"WORD");
-			return;
+	for (i = 0; i < 256; i++) {
+		if (values[i] == -ENODATA)
+			continue;
+
+		if (values[i] < 0)
+			(*bad)++;
+		else
+			(*good)++;
+
+		/* errors don't hide good values until those expire */
+		if (values[i] < 0 && pg->values[i] >= 0
+				&& ns[i] - pg->ns[i]
+					<= pdev->ttl_ns[pmdev->op[i]->poll])
+			continue;
+		pg->values[i] = values[i];
+		pg->ns[i] = ns[i];
+	}
+}
+
+/* When nothing on the page could be reread:  values past their TTL
+ * become errors.  Returns true if any did.
+ */
+static bool pmbus_dev_poll_expire(struct pmbus_poll_dev *pdev,
+		struct pmbus_poll_page *pg, int error)
+{
+	u64		now = pmbus_now_ns();
+	unsigned	i;
+	bool		expired = false;
+
+	for (i = 0; i < 256; i++) {
+		if (pg->values[i] < 0 || now - pg->ns[i]
+				<= pdev->ttl_ns[pdev->dev.op[i]->poll])
+			continue;
+		pg->values[i] = error;
+		pg->ns[i] = now;
+		expired = true;
+	}
+	return expired;
+}
+
+/* Reread the classes that are due on one page, and publish the result
+ * while the device is still there:  VOUT_MODE is per page.
+ */
+static int pmbus_dev_poll_page(struct pmbus_poll_dev *pdev,
+		struct pmbus_poll_page *pg, const bool due[POLL_CLASSES])
+{
+	int		cls, status;
+	unsigned	good = 0, bad = 0;
+
+	if (pg->page >= 0) {
+		status = pmbus_dev_set_page(&pdev->dev, pg->page);
+		if (status < 0) {
+			if (pmbus_dev_poll_expire(pdev, pg, status))
+				pmbus_dev_poll_save(pdev, pg);
+			return status;
 		}
-		if (value >= 0)
-			printf("Status %04x: ", value);
 	}
+	for (cls = 0; cls < POLL_CLASSES && due[cls]; cls++)
+		continue;
+	if (cls == POLL_CLASSES)
+		pmbus_dev_poll_read(pdev, pg, -1, &good, &bad);
+	else {
+		for (cls = 0; cls < POLL_CLASSES; cls++) {
+			if (due[cls])
+				pmbus_dev_poll_read(pdev, pg, cls,
+						&good, &bad);
+		}
+	}
+	status = pmbus_dev_poll_save(pdev, pg);
 
-	/* else use status byte */
-	if (value < 0) {
-		mode = checksupport(pmdev, PMB_STATUS_BYTE);
-		if (mode != 0) {
-			value = pmbus_read_byte_data(pmdev->fd,
-					PMB_STATUS_BYTE);
-			if (value < 0) {
-				if (mode == 1)
-					printf("  ** Device failed read"
-							"of STATUS_%s?\n",
-							"BYTE");
-				return;
-			}
-			printf("Status %02x: ", value);
+	/* A device that's been reset (or was gone) has forgotten PAGE
+	 * too.  Devices often NAK a command or two they claim to support,
+	 * so that takes every read failing.
+	 */
+	if (bad && !good)
+		pdev->dev.page = -1;
+	return status;
+}
+
+/*
+ * The poll planner:  everything due is read a page at a time, starting
+ * with whatever page the device was left on.  Returns the last error.
+ */
+static int pmbus_dev_poll(struct pmbus_poll_dev *pdev,
+		const bool due[POLL_CLASSES])
+{
+	struct pmbus_poll_page	*pg;
+	unsigned		i, first = 0;
+	int			status, ret = 0;
+
+	for (i = 0; i < pdev->npages; i++) {
+		if (pdev->pages[i].page == pdev->dev.page)
+			first = i;
+	}
+	for (i = 0; i < pdev->npages; i++) {
+		pg = &pdev->pages[(first + i) % pdev->npages];
+		status = pmbus_dev_poll_page(pdev, pg, due);
+		if (status < 0) {
+			if (verbose)
+				fprintf(stderr, "%s: poll failed: %s\n",
+						pg->state_path,
+						strerror(-status));
+			ret = status;
 		}
 	}
+	return ret;
+}
 
-	showbits(value, 16, bits);
-	printf("\n");
+/* On the bus worker:  poll, then publish what's new */
+static int pmbus_poll_work(struct pmbus_work *w)
+{
+	struct pmbus_poll_req	*req = (struct pmbus_poll_req *) w;
+	struct pmbus_poll_dev	*pdev = req->pdev;
+	int			cls = req->cls;
+	bool			overdue = pdev->pending[cls];
+	bool			due[POLL_CLASSES] = { }, any = false;
+	bool			spare;
+	int			i;
+
+	/* Fast polls always; the rest only while the bus has time to spare,
+	 * or once they've been put off for a whole period.  Whether there's
+	 * time is decided before anything is charged, else fast polls would
+	 * keep the others waiting that whole period.
+	 */
+	spare = pdev->pbus->free_ns <= pmbus_now_ns();
+	pdev->stats = req->timer;
+	pdev->pending[cls] = true;
+	for (i = POLL_CLASSES - 1; i >= 0; i--) {
+		if (!pdev->pending[i])
+			continue;
+		if (!pmbus_bus_admit(pdev->pbus, pdev->wire_ns[i],
+					spare || i == POLL_FAST
+					|| (i == cls && overdue))) {
+			if (i == cls)
+				pdev->deferred[i]++;
+			continue;
+		}
+		pdev->pending[i] = false;
+		due[i] = any = true;
+	}
+	return any ? pmbus_dev_poll(pdev, due) : -EAGAIN;
+}
 
-	if (value & ((1 << 15) | (1 << 5)))
-		show_status_vout(pmdev);
-	if (value & ((1 << 14) | (1 << 4)))
-		show_status_iout(pmdev);
-	if (value & ((1 << 13) | (1 << 3)))
-		show_status_input(pmdev);
-	if (value & (1 << 12))
-		show_status_mfr_specific(pmdev);
+/* Completion:  the results are published, the request can be reused */
+static void pmbus_poll_done(struct pmbus_work *w, int status)
+{
+	struct pmbus_poll_req	*req = (struct pmbus_poll_req *) w;
 
-	if (value & (1 << 10))
-		show_status_fans(pmdev);
-	if (value & (1 << 9))
-		show_status_other(pmdev);
+	atomic_store(&req->busy, false);
+}
 
-	if (value & (1 << 2))
-		show_status_temperature(pmdev);
-	if (value & (1 << 1))
-		show_status_cml(pmdev);
+/* On the main thread:  hand the poll to the bus worker */
+static void pmbus_dev_poll_timer(struct pmbus_timer *t)
+{
+	struct pmbus_poll_dev	*pdev = t->data;
+	struct pmbus_poll_req	*req = &pdev->req[t - pdev->timer];
 
-	printf("\n");
+	/* still busy with the last one? */
+	if (atomic_exchange(&req->busy, true)) {
+		t->missed++;
+		return;
+	}
+	memcpy(req->timer, pdev->timer, sizeof req->timer);
+	pmbus_worker_queue(&pdev->pbus->worker, &req->work);
 }
 
-static bool vout_mode_is_linear(struct pmbus_dev *pmdev)
+/* Returns the index of the named bus, adding it if needed */
+static int pmbus_daemon_bus(struct pmbus_daemon *d, const char *name)
 {
-	if (pmdev->op[PMB_VOUT_MODE] == &unsupported)
-		return false;
+	struct pmbus_poll_bus	*pbus;
+	unsigned		i;
 
-	if (pmdev->op[PMB_VOUT_MODE]->c[0].R & 0xe0)
-		return false;
+	for (i = 0; i < d->npbus; i++) {
+		if (strcmp(d->pbus[i].name, name) == 0)
+			return i;
+	}
+	pbus = realloc(d->pbus, (d->npbus + 1) * sizeof *pbus);
+	if (!pbus)
+		return -ENOMEM;
+	d->pbus = pbus;
+	pbus += d->npbus;
+	memset(pbus, 0, sizeof *pbus);
+	pbus->worker.efd = -1;
+	pbus->name = strdup(name);
+	if (!pbus->name)
+		return -ENOMEM;
+	pbus->util = 0.5;
+	return d->npbus++;
+}
 
-	return true;
+/* Add a page to poll; each only once, and "no page" only alone */
+static int pmbus_poll_add_page(struct pmbus_poll_dev *pdev, int page,
+		const double period[POLL_CLASSES])
+{
+	struct pmbus_poll_page	*pg;
+	unsigned		i;
+
+	for (i = 0; i < pdev->npages; i++) {
+		if (pdev->pages[i].page == page || pdev->pages[i].page < 0
+				|| page < 0)
+			return -EEXIST;
+	}
+	pg = realloc(pdev->pages, (pdev->npages + 1) * sizeof *pg);
+	if (!pg)
+		return -ENOMEM;
+	pdev->pages = pg;
+	pg += pdev->npages++;
+
+	pg->page = page;
+	pg->state_path = NULL;
+	for (i = 0; i < 256; i++)
+		pg->values[i] = -ENODATA;
+
+	/* pages share the device's schedule:  the most frequent asked */
+	for (i = 0; i < POLL_CLASSES; i++) {
+		if (period[i] && (!pdev->period[i]
+					|| period[i] < pdev->period[i]))
+			pdev->period[i] = period[i];
+	}
+	return 0;
 }
 
-static double pmbus_to_vout_format(struct pmbus_dev *pmdev, const int value)
-{
-	int exponent = pmdev->op[PMB_VOUT_MODE]->c[0].R & 0x1f;
-	const int mask = 0xf;
-	double result = value;
+static int pmbus_daemon_add(struct pmbus_daemon *d, char *bus, u8 addr,
+		int page, bool force, const double period[POLL_CLASSES])
+{
+	struct pmbus_poll_dev	*pdev;
+	struct pmbus_dev	*share = NULL;
+	unsigned		i;
+	int			index, status;
+
+	index = pmbus_daemon_bus(d, bus);
+	if (index < 0)
+		return index;
+
+	/* another page of a device we already have? */
+	for (i = 0; i < d->npdev; i++) {
+		pdev = &d->pdev[i];
+		if (pdev->bus != index || pdev->dev.addr != addr)
+			continue;
+		status = pmbus_poll_add_page(pdev, page, period);
+		if (status == 0)
+			free(bus);
+		return status;
+	}
+
+	pdev = realloc(d->pdev, (d->npdev + 1) * sizeof *pdev);
+	if (!pdev)
+		return -ENOMEM;
+	d->pdev = pdev;
 
-	if (exponent & 0x10) {
-		/* convert from two's complement */
-		exponent = -(-(exponent & mask) + (exponent & ~mask));
+	/* one bus handle per bus, where that works */
+	for (i = 0; i < d->npdev && !share; i++) {
+		if (pdev[i].bus == index)
+			share = &pdev[i].dev;
 	}
+	pdev += d->npdev;
 
-	if (exponent > 0) {
-		for (int i = 0; i < exponent; ++i) {
-			result *= 2.0;
-		}
-	} else {
-		for (int i = 0; i < -exponent; ++i) {
-			result /= 2.0;
-		}
+	if (pmbus_dev_open(&pdev->dev, bus, addr, force, share) < 0)
+		return -ENODEV;
+	if (pmbus_dev_scan(&pdev->dev) < 0) {
+		pmbus_dev_close(&pdev->dev);
+		return -ENODEV;
+	}
+	pmbus_dev_resolve(&pdev->dev, NULL);
+	pdev->pages = NULL;
+	pdev->npages = 0;
+	memset(pdev->period, 0, sizeof pdev->period);
+	if (pmbus_poll_add_page(pdev, page, period) < 0) {
+		pmbus_dev_close(&pdev->dev);
+		return -ENOMEM;
 	}
-	return result;
+	memset(pdev->timer, 0, sizeof pdev->timer);
+	for (i = 0; i < POLL_CLASSES; i++)
+		pdev->timer[i].fd = -1;
+	pdev->bus = index;
+	for (i = 0; i < POLL_CLASSES; i++) {
+		pdev->req[i].work.fn = pmbus_poll_work;
+		pdev->req[i].work.done = pmbus_poll_done;
+		pdev->req[i].cls = i;
+		atomic_init(&pdev->req[i].busy, false);
+	}
+	memset(pdev->pending, 0, sizeof pdev->pending);
+	memset(pdev->deferred, 0, sizeof pdev->deferred);
+	d->npdev++;
+	return 0;
 }
 
-/*----------------------------------------------------------------------*/
-
-static void pmbus_dev_show_commands(struct pmbus_dev *pmdev)
+/* Parse "fast", "slow", "static" or "interval" (= "fast") */
+static int pmbus_poll_class_parse(const char *name)
 {
-	unsigned		i;
-	struct pmbus_cmd_desc	*op;
+	int	i;
 
-	printf("Supported Commands:\n");
-	for (i = 0; i < 255; i++) {
-		char			*format;
-		int			direct = 0;
+	if (strcmp(name, "interval") == 0)
+		return POLL_FAST;
+	for (i = 0; i < POLL_CLASSES; i++) {
+		if (strcmp(name, pmbus_poll_class[i].name) == 0)
+			return i;
+	}
+	return -1;
+}
 
-		op = pmdev->op[i];
-		if (op == &unsupported || !op)
+static int pmbus_daemon_config(struct pmbus_daemon *d, const char *path)
+{
+	FILE		*f;
+	char		line[256], *word[12], *s;
+	unsigned	lineno = 0, n, i;
+	int		addr, page, cls, status = 0;
+	bool		force;
+	double		period[POLL_CLASSES], x;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while (status == 0 && fgets(line, sizeof line, f)) {
+		lineno++;
+		s = strchr(line, '#');
+		if (s)
+			*s = '\0';
+		for (n = 0, s = strtok(line, " \t\n"); s && n < 12;
+				s = strtok(NULL, " \t\n"))
+			word[n++] = s;
+		if (n == 0)
 			continue;
 
-		/* command inputs and outputs */
-		switch (op->type) {
-		case W0:
-			format = "nodata";
-			break;
-		case RW1:
-		case W1:
-		case R1:
-			format = "u8 (bitmask)";
-			break;
-		case RW2:
-		case R2:
-			if (op->flags == FLG_FORMAT_VOUT && vout_mode_is_linear(pmdev)) {
-				format = "x16 (VOUT_MODE)";
+		status = -1;
+		cls = pmbus_poll_class_parse(word[0]);
+		if (cls >= 0 && (n == 2 || n == 3)) {
+			x = strtod(word[1], &s);
+			if (*s || !(x >= POLL_PERIOD_MIN))
 				break;
+			pmbus_poll_class[cls].period = x;
+			if (n == 3) {
+				x = strtod(word[2], &s);
+				if (*s || !(x > 0))
+					break;
+				pmbus_poll_class[cls].ttl = x;
 			}
-			switch ((op->query >> 2) & 7) {
-			case 0:
-				if (op->units == BITS)
-					format = "u16 (bitmask)";
-				else
-					format = "s16 (LINEAR)";
-				break;
-			case 3:
-				format = "s16 (DIRECT)";
-				direct = 1;
-				break;
-			case 5:
-				format = "u16 (VID)";
+		} else if (strcmp(word[0], "state") == 0 && n == 2) {
+			free(d->state_dir);
+			d->state_dir = strdup(word[1]);
+		} else if (strcmp(word[0], "bus") == 0 && n >= 2) {
+			struct pmbus_poll_bus	*pbus;
+
+			i = pmbus_daemon_bus(d, word[1]);
+			if ((int) i < 0)
 				break;
-			case 6:
-				format = "x16 (MFR)";
+			pbus = &d->pbus[i];
+			for (i = 2; i + 1 < n; i += 2) {
+				x = strtod(word[i + 1], &s);
+				if (*s || !(x > 0))
+					break;
+				if (strcmp(word[i], "khz") == 0)
+					pbus->khz = x;
+				else if (strcmp(word[i], "util") == 0
+						&& x <= 100)
+					pbus->util = x / 100;
+				else
+					break;
+			}
+			if (i != n)
 				break;
-			default:
-				format = "x16 (UNKNOWN)";
+		} else if (strcmp(word[0], "device") == 0 && n >= 3) {
+			addr = pmbus_parse_addr(word[2]);
+			if (addr < 0)
 				break;
+			page = -1;
+			force = false;
+			memset(period, 0, sizeof period);
+			for (i = 3; i < n; i++) {
+				cls = pmbus_poll_class_parse(word[i]);
+				if (strcmp(word[i], "force") == 0)
+					force = true;
+				else if (cls >= 0 && i + 1 < n) {
+					period[cls] = strtod(word[++i], &s);
+					if (*s || !(period[cls] >= POLL_PERIOD_MIN))
+						break;
+				} else if (strcmp(word[i], "page") == 0
+						&& i + 1 < n) {
+					page = strtol(word[++i], &s, 0);
+					if (*s || page < 0 || page > 0xff)
+						break;
+				} else
+					break;
 			}
-			break;
-		case RWB:
-		case RWB14:
-			format = "block";
-			break;
-		case RWP_QUERY:
-		case RWP_COEFF:
-			format = "process_call";
-			break;
-		case RWB_APP_PROFILE:
-			format = "(Application Profile)";
-			break;
-		case ENERGY:
-			switch ((op->query >> 2) & 7) {
-			case 0:
-				format = "block(6), Energy counter (LINEAR)";
-				break;
-			case 3:
-				format = "block(6), Energy counter (DIRECT)";
+			if (i < n)
 				break;
-			default:
-				format = "block(6), Energy counter (UNKNOWN)";
+			s = strdup(word[1]);
+			if (!s || pmbus_daemon_add(d, s, addr, page,
+						force, period) < 0) {
+				free(s);
+				/* e.g. an empty slot; poll the others */
+				fprintf(stderr, "%s:%u: device not added\n",
+						path, lineno);
+				status = 0;
+				continue;
 			}
+		} else
 			break;
-		default:
-			format = "(UNKNOWN call syntax)";
-			break;
-		}
+		status = 0;
+	}
+	if (status == -1)
+		fprintf(stderr, "%s:%u: bad config line\n", path, lineno);
+	fclose(f);
+	if (status == 0 && d->npdev == 0) {
+		fprintf(stderr, "%s: no devices to poll\n", path);
+		status = -1;
+	}
+	return status;
+}
 
-		/* Now display it all */
-		printf("  %02x %-25s %c%c %s",
-			op->cmd, op->tag,
-			(op->query & (1 << 5)) ? 'r' : ' ',
-			(op->query & (1 << 6)) ? 'w' : ' ',
-			format);
+static int pmbus_daemon_run(const char *config)
+{
+	struct pmbus_daemon	d = { };
+	struct sigaction	sa = { .sa_handler = pmbus_daemon_signal, };
+	struct pmbus_poll_dev	*pdev;
+	struct pmbus_poll_page	*pg;
+	struct pmbus_poll_bus	*pbus;
+	struct pmbus_timer	*t;
+	unsigned		i, j, *khz, *slot;
+	int			epfd, status = 0;
+	u64			start, period, phase;
+	bool			all[POLL_CLASSES];
+
+	memset(all, 1, sizeof all);
+	d.state_dir = strdup(".");
+	if (pmbus_daemon_config(&d, config) < 0)
+		return 1;
+	khz = calloc(d.npbus, sizeof *khz);
+	slot = calloc(d.npbus, sizeof *slot);
+	if (!khz || !slot) {
+		perror("calloc");
+		return 1;
+	}
 
-		format = units(op);
-		if (format == NULL && op->units == STRING)
-			format = "ISO 8859/1 string";
-		if (format)
-			printf(", %s", format);
+	/* no SA_RESTART:  signals cut epoll_wait() short */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 
-		printf("\n");
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return 1;
+	}
 
-		/* dump coefficients; "always" R, maybe W too */
-		if (direct && (op->c[1].valid || op->c[0].valid)) {
-			printf("     Coefficients: ");
-			if (op->c[1].valid)	/* Read */
-				printf("READ b=%d m=%d R=%d",
-					op->c[1].b, op->c[1].m, op->c[1].R);
-			else
-				printf("no READ coefficients?");
-			if (op->c[0].valid)	/* Write */
-				printf("; WRITE b=%d m=%d R=%d",
-					op->c[0].b, op->c[0].m, op->c[0].R);
-			printf("\n");
+	/* unless told otherwise, buses run as fast as all devices allow */
+	for (i = 0; i < d.npdev; i++) {
+		pdev = &d.pdev[i];
+		pbus = &d.pbus[pdev->bus];
+		pdev->pbus = pbus;
+		for (j = 0; j < POLL_CLASSES; j++) {
+			pdev->req[j].pdev = pdev;
+			if (!pdev->period[j])
+				pdev->period[j] = pmbus_poll_class[j].period;
+			pdev->ttl_ns[j] = 1e9 * (pmbus_poll_class[j].ttl
+					? pmbus_poll_class[j].ttl
+					: 3 * pdev->period[j]);
 		}
+		if (!pbus->ndevs++ || pmbus_dev_khz(&pdev->dev) < khz[pdev->bus])
+			khz[pdev->bus] = pmbus_dev_khz(&pdev->dev);
+	}
+	start = pmbus_now_ns();
+	for (i = 0; i < d.npbus; i++) {
+		if (!d.pbus[i].khz)
+			d.pbus[i].khz = khz[i] ? khz[i] : 100;
+		d.pbus[i].start_ns = start;
 	}
-}
-
-static double pmbus_convert_from_direct(struct pmbus_cmd_desc *op, int value)
-{
-	double	d;
-	int r;
-
-	/* DIRECT encoding:
-	 *  X = ((value * (10 ^ -R)) - b) / m
-	 */
-	d = value;
 
-	/* ideally:
-	 *   d *= exp10((double)-op->c[1].R);
-	 * but that, or pow(), can be unavailable
+	/* Read everything once, then each class on its own schedule.
+	 * Polls of each bus are spread evenly over each period.
 	 */
-	r = op->c[1].R;
-	if (r < 0) {
-		do {
-			d *= 10.0;
-			r++;
-		} while (r < 0);
-	} else if (r > 0) {
-		do {
-			d /= 10.0;
-			r--;
-		} while (r > 0);
-	}
-	d -= (double)op->c[1].b;
-	d /= (double)op->c[1].m;
-	return d;
+	for (i = 0; i < d.npdev && status == 0; i++) {
+		pdev = &d.pdev[i];
+		pbus = pdev->pbus;
+		for (j = 0; j < pdev->npages; j++) {
+			pg = &pdev->pages[j];
+			pg->state_path = pmbus_state_path(d.state_dir,
+					pdev->dev.bus, pdev->dev.addr,
+					pg->page);
+			if (!pg->state_path)
+				status = -ENOMEM;
+		}
+		if (status == 0) {
+			pmbus_bus_admit(pbus, pmbus_poll_wire_ns(pdev, -1,
+						pbus->khz), true);
+			pdev->stats = pdev->timer;	/* no workers yet */
+			status = pmbus_dev_poll(pdev, all);
+		}
+		if (status < 0) {
+			fprintf(stderr, "%s %#02x: %s\n", pdev->dev.bus,
+					pdev->dev.addr, strerror(-status));
+			break;
+		}
+		for (j = 0; j < POLL_CLASSES && status == 0; j++) {
+			t = &pdev->timer[j];
+			period = 1e9 * pdev->period[j];
+			phase = period * (slot[pdev->bus] * POLL_CLASSES + j)
+					/ (pbus->ndevs * POLL_CLASSES);
+			pdev->wire_ns[j] = pmbus_poll_wire_ns(pdev, j,
+					pbus->khz);
+			t->fn = pmbus_dev_poll_timer;
+			t->data = pdev;
+			status = pmbus_timer_start(t, epfd,
+					start + period + phase, period);
+		}
+		slot[pdev->bus]++;
+	}
+	for (i = 0; i < d.npbus && status == 0; i++) {
+		status = pmbus_worker_start(&d.pbus[i].worker);
+		if (status < 0)
+			fprintf(stderr, "%s: worker: %s\n", d.pbus[i].name,
+					strerror(-status));
+	}
+	if (status == 0) {
+		status = pmbus_timer_loop(epfd, &pmbus_daemon_stop);
+		if (status < 0)
+			fprintf(stderr, "poll timers: %s\n",
+					strerror(-status));
+	}
+	for (i = 0; i < d.npbus; i++)
+		pmbus_worker_stop(&d.pbus[i].worker);
+
+	for (i = 0; i < d.npdev; i++) {
+		pdev = &d.pdev[i];
+		for (j = 0; j < POLL_CLASSES; j++) {
+			t = &pdev->timer[j];
+			if (verbose && t->runs)
+				fprintf(stderr, "%s %#02x: %s, %llu polls, "
+					"%llu missed, jitter usec "
+					"avg %.1f max %.0f\n",
+					pdev->dev.bus, pdev->dev.addr,
+					pmbus_poll_class[j].name,
+					(unsigned long long) t->runs,
+					(unsigned long long) t->missed,
+					t->jitter_sum_ns / 1e3 / t->runs,
+					t->jitter_max_ns / 1e3);
+			if (t->fd >= 0)
+				close(t->fd);
+		}
+		if (use_cache)
+			pmbus_cache_save(&pdev->dev);
+	}
+	/* owners come first; close them last */
+	for (i = d.npdev; i-- > 0; )
+		pmbus_dev_close(&d.pdev[i].dev);
+	for (i = 0; verbose && i < d.npbus; i++)
+		fprintf(stderr, "%s: %u KHz, %.1f%% busy (limit %.0f%%)\n",
+				d.pbus[i].name, d.pbus[i].khz,
+				pmbus_bus_util(&d.pbus[i]) * 100,
+				d.pbus[i].util * 100);
+	free(khz);
+	free(slot);
+	close(epfd);
+	return status < 0;
 }
 
-static void pmbus_dev_show_values(struct pmbus_dev *pmdev)
-{
-	unsigned		i;
-	struct pmbus_cmd_desc	*op;
+/*----------------------------------------------------------------------*/
 
-	printf("Attribute Values:\n");
-	for (i = 0; i < 255; i++) {
-		int		value;
-		const char	*name;
+/*
+ * Batch mode ("--batch"):  run a stream of operations from stdin in one
+ * process, so that bus handles and what's been learned about each device
+ * (QUERY results, coefficients, VOUT_MODE, PAGE) are reused rather than
+ * rediscovered for every operation.  One operation per line; '#' starts
+ * a comment:
+ *
+ *   device BUS ADDR [force]	select a device, opening it if needed
+ *				(reselecting it takes the same "force")
+ *   page N			select PAGE, unless it's already selected
+ *   read CMD			read a byte or word; CMD is a tag like
+ *				"read_vout", or a command code
+ *   write CMD VALUE		write a raw byte or word, or with no
+ *				VALUE, send just the command
+ *   clear			CLEAR_FAULTS
+ *
+ * Each operation gets one line of output, starting with "ok" or "error".
+ * Reads add the tag and value, as in the daemon's state files.
+ */
+struct pmbus_batch_dev {
+	struct pmbus_dev	dev;
+	bool			force;
+};
 
-		op = pmdev->op[i];
-		if (op == &unsupported || !op)
-			continue;
-		if (op->flags & (FLG_SHOW_P1|FLG_STATUS))
-			continue;
+static const struct pmbus_cmd_desc *pmbus_cmd_parse(const char *str)
+{
+	const struct pmbus_cmd_desc	*op;
+	char				*end;
+	long				cmd;
+
+	cmd = strtol(str, &end, 0);
+	if (*str && !*end)
+		return (cmd >= 0 && cmd <= 0xff) ? pmbus_cmd_lookup(cmd) : NULL;
+	for_each_pmbus_op(op) {
+		if (strcmp(op->tag, str) == 0)
+			return op;
+	}
+	return NULL;
+}
 
-		name = op->tag;
-		if (strncmp(name, "read_", 5) == 0)
-			name += 5;
+static const char *pmbus_batch_read(struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_desc *op)
+{
+	int	value;
+
+	switch (op->type) {
+	case RW1:
+	case R1:
+		value = pmbus_read_byte_data(pmdev, op->cmd);
+		break;
+	case RW2:
+	case R2:
+		value = pmbus_read_word_data(pmdev, op->cmd);
+		break;
+	default:
+		return "can't read that";
+	}
+	if (value < 0)
+		return strerror(-value);
+	printf("ok %s", op->tag);
+	pmbus_fprint_value(stdout, pmdev, op, value);
+	return NULL;
+}
 
-		/* read and display values, where that's meaningful */
-		switch (op->type) {
-		case W0:
-		case W1:
-		case RWP_QUERY:
-		case RWP_COEFF:
-		default:
-			/* write-only or magic */
-			continue;
-		case RW1:
-		case R1:
-			value = pmbus_read_byte_data(pmdev->fd, op->cmd);
-			if (value < 0) {
-				printf("  %-21s [ERROR reading]", name);
-				continue;
-			}
-			printf("  %-21s %02x: ", name, value);
-/* FIXME need per-op (bitmask) decoders... */
-			printf("(BITMAP)");
-			printf("\n");
-			continue;
-		case RW2:
-		case R2:
-			value = pmbus_read_word_data(pmdev->fd, op->cmd);
-			if (value < 0) {
-				/* FIXME display a diagnostic */
-				continue;
-			}
-			printf("  %-21s %04x: ", name, value);
-/* FIXME need decoders */
-			if (op->flags == FLG_FORMAT_VOUT && vout_mode_is_linear(pmdev)) {
-				printf("%g", pmbus_to_vout_format(pmdev, value));
-				break;
-			}
-			switch ((op->query >> 2) & 7) {
-			case 0:
-				if (op->units == BITS) {
-					printf("(BITMAP)");
-				} else {
-					double	d = value & 0x03ff;
-
-					/* LINEAR encoding:
-					 *  - 11 LSBs are signed mantissa
-					 *  - 5 LSBs are signed exponent
-					 */
-					if (value & 0x0400)
-						d = -d;
-					if (value & 0x8000)
-						d /= 1 <<
-							(0x0f + 1 - (value >> 11) & 0x0f);
-					else if (value & 0x7100)
-						d *= 1 << (value >> 11);
-					printf("%g", d);
-				}
-				break;
-			case 1:
-				/* 16-bit unsigned */
-				printf("%d", value);
-				break;
-			case 3: {
-				double	d;
-				int r;
-
-				/* DIRECT encoding:
-				 *  X = ((value * (10 ^ -R)) - b) / m
-				 */
-				d = (s16) value;
-
-				/* ideally:
-				 *   d *= exp10((double)-op->c[1].R);
-				 * but that, or pow(), can be unavailable
-				 */
-				r = op->c[1].R;
-				if (r < 0) {
-					do {
-						d *= 10.0;
-						r++;
-					} while (r < 0);
-				} else if (r > 0) {
-					do {
-						d /= 10.0;
-						r--;
-					} while (r > 0);
-				}
-				d -= (double)op->c[1].b;
-				d /= (double)op->c[1].m;
-				printf("%g", d);
-				}
-				break;
-			case 4:
-				/* 8-bit unsigned */
-				printf("%d", value & 0xff);
-				break;
-			case 5:
-				printf("u16 (VID)");
-				break;
-			case 6:
-				printf("manufacturer specific");
-				break;
-			default:
-				printf("unknown format");
-				break;
-			}
-			break;
+static const char *pmbus_batch_write(struct pmbus_dev *pmdev,
+		const struct pmbus_cmd_desc *op, const char *arg)
+{
+	char	*end;
+	long	value = 0;
+	int	status;
+
+	if (arg) {
+		value = strtol(arg, &end, 0);
+		if (!*arg || *end || value < 0)
+			return "bad value";
+	}
+	switch (op->type) {
+	case W0:
+		if (arg)
+			return "takes no value";
+		status = smbus_write_byte(pmdev, op->cmd);
+		break;
+	case RW1:
+	case W1:
+		if (!arg || value > 0xff)
+			return "needs a byte value";
+		status = pmbus_write_byte_data(pmdev, op->cmd, value);
+		break;
+	case RW2:
+		if (!arg || value > 0xffff)
+			return "needs a word value";
+		status = pmbus_write_word_data(pmdev, op->cmd, value);
+		break;
+	default:
+		return "can't write that";
+	}
+	if (status < 0)
+		return strerror(-status);
+	printf("ok\n");
+	return NULL;
+}
 
-		case ENERGY: {
-			u8 buf[6] = {0,};
-			int size = pmbus_read_block_without_checking(pmdev, op->cmd, 6, 6, buf);
-			u16 accumulator = (buf[1] << 8) + buf[0];
-			u8 rollovers = buf[2];
-			unsigned int samples = (buf[5] << 16) + (buf[4] << 8) + buf[3];
-			printf("  %-21s %02x%02x%02x%02x%02x%02x: ", name, buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
-			switch ((op->query >> 2) & 7) {
-			case 0: {
-				/* linear format */
-				const int max_value = ((2 << 9) - 1) * (2 << 14); /* ((2^10) - 1) * 2^15 == 33521664 */
-				double energy_count = rollovers * max_value + accumulator;
-				printf("%g", energy_count);
-				}
-				break;
-			case 3: {
-				/* direct mode */
-				double energy_count;
-				const int y_max = ((2 << 14) - 1); /* (2^15) - 1 == 32767 */
-				int r = op->c[1].R;
-				double max_value = (double)(op->c[1].m * y_max + op->c[1].b);
-				if (r < 0) {
-					do {
-						max_value /= 10.0;
-						++r;
-					} while (r < 0);
-				} else if (r > 0) {
-					do {
-						max_value *= 10.0;
-						--r;
-					} while (r > 0);
-				}
-				energy_count = rollovers * max_value + pmbus_convert_from_direct(op, accumulator);
-				printf("%g", energy_count);
-				//printf(" [coeffs: m = %d, b = %d, R = %d]", op->c[1].m, op->c[1].b, op->c[1].R);
-				}
+/* Returns NULL after printing the result, else an error message */
+static const char *pmbus_batch_op(struct pmbus_batch_dev ***devs,
+		unsigned *ndevs, struct pmbus_dev **cur,
+		char **word, unsigned n)
+{
+	const struct pmbus_cmd_desc	*op;
+	struct pmbus_batch_dev		*bdev = NULL, **more;
+	char				*end, *bus;
+	const char			*err;
+	long				x;
+	int				addr;
+	unsigned			i;
+
+	if (strcmp(word[0], "device") == 0) {
+		if (n < 3 || n > 4 || (n == 4 && strcmp(word[3], "force")))
+			return "usage:  device BUS ADDR [force]";
+		addr = pmbus_parse_addr(word[2]);
+		if (addr < 0)
+			return "bad address";
+		for (i = 0; i < *ndevs; i++) {
+			bdev = (*devs)[i];
+			if (bdev->dev.addr == addr
+					&& strcmp(bdev->dev.bus, word[1]) == 0)
 				break;
-			default:
-				printf("(error: QUERY 0x%02x)", op->query);
+		}
+		if (i < *ndevs && bdev->force != (n == 4))
+			return bdev->force ? "device is open with force"
+				: "device is open without force";
+		if (i == *ndevs) {
+			bus = strdup(word[1]);
+			bdev = calloc(1, sizeof *bdev);
+			if (!bus || !bdev) {
+				free(bus);
+				free(bdev);
+				return strerror(ENOMEM);
 			}
+			more = realloc(*devs, (*ndevs + 1) * sizeof *more);
+			if (!more) {
+				err = strerror(ENOMEM);
+				goto fail;
 			}
-			break;
-#if 0
-//	RWB,		/* read/write block (up to 255 bytes) */
-//	RWB14,		/* read/write block (of 14 bytes) */
-		case RWB:
-		case RWB14:
-			format = "block";
-#endif
-			break;
+			*devs = more;
+			bdev->force = (n == 4);
+			for (i = 0; i < *ndevs; i++) {
+				if (strcmp((*devs)[i]->dev.bus, bus) == 0)
+					break;
+			}
+			if (pmbus_dev_open(&bdev->dev, bus, addr, bdev->force,
+					i < *ndevs ? &(*devs)[i]->dev : NULL) < 0) {
+				err = "can't open device";
+				goto fail;
+			}
+			if (pmbus_dev_scan(&bdev->dev) < 0) {
+				pmbus_dev_close(&bdev->dev);
+				err = "can't scan device";
+				goto fail;
+			}
+			(*devs)[(*ndevs)++] = bdev;
 		}
+		*cur = &bdev->dev;
+		printf("ok %s %#02x\n", bdev->dev.bus, bdev->dev.addr);
+		return NULL;
+	}
 
-		name = units(op);
-		if (name)
-			printf(" %s", name);
-		printf("\n");
+	if (!*cur)
+		return "no device selected";
+
+	if (strcmp(word[0], "page") == 0 && n == 2) {
+		x = strtol(word[1], &end, 0);
+		if (*end || x < 0 || x > 0xff)
+			return "bad page";
+		x = pmbus_dev_set_page(*cur, x);
+		if (x < 0)
+			return strerror(-x);
+		printf("ok\n");
+		return NULL;
 	}
-	printf("\n");
+
+	if (strcmp(word[0], "clear") == 0 && n == 1) {
+		if (checksupport(*cur, PMB_CLEAR_FAULT) == 0)
+			return "not supported";
+		x = smbus_write_byte(*cur, PMB_CLEAR_FAULT);
+		if (x < 0)
+			return strerror(-x);
+		printf("ok\n");
+		return NULL;
+	}
+
+	if ((strcmp(word[0], "read") == 0 && n == 2)
+			|| (strcmp(word[0], "write") == 0 && (n == 2 || n == 3))) {
+		op = pmbus_cmd_parse(word[1]);
+		if (!op)
+			return "unknown command";
+		if (checksupport(*cur, op->cmd) == 0)
+			return "not supported";
+		if (word[0][0] == 'r')
+			return pmbus_batch_read(*cur, op);
+		return pmbus_batch_write(*cur, op, n == 3 ? word[2] : NULL);
+	}
+
+	return "unknown operation";
+
+fail:
+	free(bus);
+	free(bdev);
+	return err;
 }
 
-static void pmbus_dev_show(struct pmbus_dev *pmdev, bool values, bool cmds)
+static int pmbus_batch_run(void)
 {
-	pmbus_dev_show_p1(pmdev);
-	if (values) {
-		pmbus_dev_show_status(pmdev);
-		pmbus_dev_show_values(pmdev);
+	struct pmbus_batch_dev	**devs;
+	struct pmbus_dev	*cur = NULL;
+	unsigned		ndevs = 0, n, i;
+	char			line[256], *word[4], *s;
+	const char		*err;
+	int			errors = 0;
+
+	devs = NULL;
+	while (fgets(line, sizeof line, stdin)) {
+		s = strchr(line, '#');
+		if (s)
+			*s = '\0';
+		for (n = 0, s = strtok(line, " \t\n"); s;
+				s = strtok(NULL, " \t\n")) {
+			if (n == 4)
+				break;
+			word[n++] = s;
+		}
+		if (n == 0)
+			continue;
+
+		if (s)
+			err = "too many words";
+		else
+			err = pmbus_batch_op(&devs, &ndevs, &cur, word, n);
+		if (err) {
+			printf("error %s\n", err);
+			errors++;
+		}
+		fflush(stdout);
 	}
-	if (cmds)
-		pmbus_dev_show_commands(pmdev);
+
+	/* owners come first; close them last */
+	for (i = ndevs; i-- > 0; ) {
+		if (use_cache)
+			pmbus_cache_save(&devs[i]->dev);
+		pmbus_dev_close(&devs[i]->dev);
+		free(devs[i]->dev.bus);
+		free(devs[i]);
+	}
+	free(devs);
+	return errors != 0;
 }
 
 /*----------------------------------------------------------------------*/
 
-static void pmbus_clear_fault(struct pmbus_dev *pmdev)
+/*
+ * Fleet scan ("--scan-all [BUS ...]"):  find PMBus devices on every
+ * i2c-dev adapter (or just the buses listed), and print an inventory.
+ * Buses are electrically independent, so each gets its own thread; a
+ * scan takes about as long as the slowest bus, not the sum of them.
+ *
+ * Every unreserved address is probed with a Quick command (or, if the
+ * adapter can't do that, a STATUS_BYTE read) and responders are scanned
+ * as usual.  Addresses claimed by kernel drivers are listed as "busy".
+ * Output is one tab-separated line per device, after a "#" header line;
+ * fields that couldn't be read show as "-".
+ */
+struct pmbus_scan_found {
+	u8			addr;
+	const char		*status;	/* "ok", "busy", "error" */
+	u8			revision;
+	u8			capability;
+	char			*ident[4];
+};
+
+struct pmbus_scan {
+	char			*bus;
+	pthread_t		thread;
+	int			status;		/* of opening the bus */
+	struct pmbus_scan_found	*found;
+	unsigned		nfound;
+};
+
+static struct pmbus_scan_found *pmbus_scan_add(struct pmbus_scan *scan,
+		u8 addr, const char *status)
 {
-	/* if we know we can't clear faults, don't try */
-	if (checksupport(pmdev, PMB_CLEAR_FAULT) != 0)
-		(void) smbus_write_byte(pmdev->fd, PMB_CLEAR_FAULT);
-}
+	struct pmbus_scan_found	*found;
 
-/*----------------------------------------------------------------------*/
+	found = realloc(scan->found, (scan->nfound + 1) * sizeof *found);
+	if (!found)
+		return NULL;
+	scan->found = found;
+	found += scan->nfound++;
+	memset(found, 0, sizeof *found);
+	found->addr = addr;
+	found->status = status;
+	return found;
+}
 
-static int pmbus_dev_scan(struct pmbus_dev *pmdev)
+/* Probe and scan everything on one bus; runs in its own thread */
+static void *pmbus_scan_bus(void *arg)
 {
-	int			status;
+	struct pmbus_scan	*scan = arg;
+	struct pmbus_scan_found	*found;
+	struct pmbus_dev	*bus, *pmdev;
+	int			addr, status;
+	unsigned		i;
 
-	/* SMBus (hence PMBus) devices must always ack their addresses.  */
-	if (pmdev->funcs & I2C_FUNC_SMBUS_QUICK) {
-		status = pmbus_quick(pmdev->fd);
-		if (status < 0) {
-			fprintf(stderr, "No device present? error %d\n",
-					status);
-			return status;
+	bus = calloc(1, sizeof *bus);
+	pmdev = malloc(sizeof *pmdev);
+	if (!bus || !pmdev) {
+		scan->status = -ENOMEM;
+		goto done;
+	}
+	bus->fd = -1;
+	bus->xport = pmbus_transport_for(scan->bus);
+	scan->status = bus->xport->open(bus, scan->bus);
+	if (scan->status < 0)
+		goto done;
+	bus->bus = scan->bus;
+	bus->want_pec = enable_pec && (bus->funcs & I2C_FUNC_SMBUS_PEC);
+	bus->rdwr_addr = !!(bus->funcs & I2C_FUNC_I2C);
+	if ((bus->funcs & i2c_func_pmbus_min) != i2c_func_pmbus_min) {
+		scan->status = -EOPNOTSUPP;
+		goto close;
+	}
+
+	for (addr = 0x09; addr <= 0x77; addr++) {
+		if (pmbus_addr_reserved(addr))
+			continue;
+		status = bus->xport->set_addr(bus, addr, false);
+		if (status == -EBUSY) {
+			pmbus_scan_add(scan, addr, "busy");
+			continue;
 		}
+		if (status < 0)
+			continue;
+		bus->addr = addr;
+		if (bus->funcs & I2C_FUNC_SMBUS_QUICK)
+			status = pmbus_quick(bus);
+		else
+			status = pmbus_read_byte_data(bus, PMB_STATUS_BYTE);
+		if (status < 0)
+			continue;
+
+		/* a fresh handle per device, sharing the bus */
+		memset(pmdev, 0, sizeof *pmdev);
+		pmdev->xport = bus->xport;
+		pmdev->xport_data = bus->xport_data;
+		pmdev->fd = bus->fd;
+		pmdev->funcs = bus->funcs;
+		pmdev->rdwr_addr = bus->rdwr_addr;
+		pmdev->shared = 1;
+		pmdev->bus = bus->bus;
+		pmdev->addr = addr;
+		pmdev->page = -1;
+		pmdev->want_pec = bus->want_pec;
+
+		if (pmbus_dev_scan(pmdev) < 0)
+			pmbus_scan_add(scan, addr, "error");
+		else {
+			if (!pmdev->ident[0])
+				pmbus_dev_identify(pmdev);
+			found = pmbus_scan_add(scan, addr, "ok");
+			if (found) {
+				found->revision = pmdev->revision;
+				found->capability = pmdev->capability;
+				memcpy(found->ident, pmdev->ident,
+						sizeof found->ident);
+			}
+			if (use_cache)
+				pmbus_cache_save(pmdev);
+			if (found)	/* its strings now */
+				memset(pmdev->ident, 0, sizeof pmdev->ident);
+		}
+		for (i = 0; i < 4; i++)
+			free(pmdev->ident[i]);
+
+		/* kernel PEC goes with the handle, not the address */
+		if (pmdev->use_pec)
+			pmbus_xfer_pec(bus, 0);
 	}
 
-	/* QUERY lets us see what operations this device supports, which is
-	 * the most interesting information available without product docs.
-	 *
-	 * It also lets us avoid making calls we know will fail, which is
-	 * polite since such failures will trigger host notification or
-	 * SMBALERT# on some devices.  If we can't query, we'll just hope
-	 * those mechanisms aren't in use.
-	 */
-	checksupport(pmdev, PMB_QUERY);
+close:
+	bus->xport->close(bus);
+done:
+	free(pmdev);
+	free(bus);
+	return NULL;
+}
 
-	if (checksupport(pmdev, PMB_CAPABILITY) != 0) {
-		status = pmbus_read_byte_data(pmdev->fd, PMB_CAPABILITY);
-		if (status < 0) {
-			if (verbose)
-				fprintf(stderr, "No PMBus capability support; "
-					"assuming no PEC, etc\n");
-		} else {
-			pmdev->capability = status;
+static int cmp_i2c_dev(const void *a, const void *b)
+{
+	const char *x = *(char *const *) a + strlen("/dev/i2c-");
+	const char *y = *(char *const *) b + strlen("/dev/i2c-");
 
-			/* enable PEC if the device supports it */
-			if ((status & (1 << 7)) && enable_pec) {
-				if (ioctl(pmdev->fd, I2C_PEC, 1) < 0)
-					fprintf(stderr, "couldn't "
-						"enable PEC\n");
-				else
-					pmdev->use_pec = 1;
+	return atoi(x) - atoi(y);
+}
+
+/* List "/dev/i2c-N" nodes, in numeric order */
+static char **pmbus_list_adapters(unsigned *n)
+{
+	DIR		*dir;
+	struct dirent	*d;
+	char		**list = NULL, **more;
+	char		*end;
+
+	*n = 0;
+	dir = opendir("/dev");
+	if (!dir)
+		return NULL;
+	while ((d = readdir(dir)) != NULL) {
+		if (strncmp(d->d_name, "i2c-", 4) != 0 || !d->d_name[4])
+			continue;
+		strtoul(d->d_name + 4, &end, 10);
+		if (*end)
+			continue;
+		more = realloc(list, (*n + 1) * sizeof *list);
+		if (!more)
+			break;
+		list = more;
+		list[*n] = malloc(strlen(d->d_name) + 6);
+		if (!list[*n])
+			break;
+		sprintf(list[(*n)++], "/dev/%s", d->d_name);
+	}
+	closedir(dir);
+	if (*n)
+		qsort(list, *n, sizeof *list, cmp_i2c_dev);
+	return list;
+}
+
+static int pmbus_scan_all(char **buses, unsigned nbuses)
+{
+	struct pmbus_scan	*scan;
+	struct pmbus_scan_found	*found;
+	char			**list = NULL;
+	unsigned		i, j, k;
+	u64			start;
+	int			status = 0;
+
+	if (!nbuses) {
+		buses = list = pmbus_list_adapters(&nbuses);
+		if (!nbuses) {
+			fprintf(stderr, "No i2c-dev adapters\n");
+			status = 1;
+			goto done;
+		}
+	}
+	scan = calloc(nbuses, sizeof *scan);
+	if (!scan) {
+		perror("calloc");
+		status = 1;
+		goto done;
+	}
+
+	start = pmbus_now_ns();
+	for (i = 0; i < nbuses; i++) {
+		scan[i].bus = buses[i];
+		if (pthread_create(&scan[i].thread, NULL, pmbus_scan_bus,
+					&scan[i]) != 0) {
+			/* no thread?  do it the slow way */
+			scan[i].thread = pthread_self();
+			pmbus_scan_bus(&scan[i]);
+		}
+	}
+	for (i = 0; i < nbuses; i++) {
+		if (!pthread_equal(scan[i].thread, pthread_self()))
+			pthread_join(scan[i].thread, NULL);
+	}
+	if (verbose)
+		fprintf(stderr, "Scanned %u buses in %.1f msec\n", nbuses,
+				(pmbus_now_ns() - start) / 1e6);
+
+	printf("# bus\taddr\tstatus\trevision\tcapability"
+			"\tmfr_id\tmfr_model\tmfr_revision\tic_device_id\n");
+	for (i = 0; i < nbuses; i++) {
+		if (scan[i].status < 0)
+			fprintf(stderr, "%s: %s\n", scan[i].bus,
+					strerror(-scan[i].status));
+		for (j = 0; j < scan[i].nfound; j++) {
+			found = &scan[i].found[j];
+			printf("%s\t%#02x\t%s", scan[i].bus, found->addr,
+					found->status);
+			if (strcmp(found->status, "ok") == 0)
+				printf("\t%#02x\t%#02x", found->revision,
+						found->capability);
+			else
+				printf("\t-\t-");
+			for (k = 0; k < 4; k++) {
+				printf("\t%s", found->ident[k]
+						? found->ident[k] : "-");
+				free(found->ident[k]);
 			}
+			printf("\n");
 		}
+		free(scan[i].found);
 	}
+	free(scan);
+done:
+	for (i = 0; list && i < nbuses; i++)
+		free(list[i]);
+	free(list);
+	return status;
+}
 
-	/* PMBus 1.0 has PMBUS_REVISION too; it's not new to PMBus 1.1 */
-	if (checksupport(pmdev, PMB_PMBUS_REVISION) != 0) {
-		status = pmbus_read_byte_data(pmdev->fd, PMB_PMBUS_REVISION);
-		if (status < 0) {
-			if (verbose)
-				fprintf(stderr, "No PMBUS_REVISION support; "
-					"assuming 1.0\n");
-		} else
-			pmdev->revision = status;
+/*----------------------------------------------------------------------*/
+
+/*
+ * "-B" benchmarks the numeric decoders on random raw words.  That needs
+ * no device; it's for choosing decoders for bulk (offline) decoding.
+ */
+
+#define BENCH_SAMPLES	(1 << 18)
+#define BENCH_ROUNDS	50
+
+static double bench_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the sum makes sure the results get used */
+static void bench_report(const char *name, double start, double sum)
+{
+	double	ns = (bench_now() - start) * 1e9
+				/ ((double) BENCH_SAMPLES * BENCH_ROUNDS);
+
+	printf("  %-28s %7.3f ns/sample  (sum %g)\n", name, ns, sum);
+}
+
+static double bench_sum(const float *out)
+{
+	double		sum = 0;
+	unsigned	i;
+
+	for (i = 0; i < BENCH_SAMPLES; i++)
+		sum += out[i];
+	return sum;
+}
+
+static double bench_sum_milli(const long long *out)
+{
+	double		sum = 0;
+	unsigned	i;
+
+	for (i = 0; i < BENCH_SAMPLES; i++)
+		sum += out[i];
+	return sum / 1000.0;
+}
+
+/* LINEAR11 decoders on whatever's in raw[] */
+static void bench_linear11(const u16 *raw, float *out, long long *mout)
+{
+	unsigned	round;
+	double		start;
+
+	start = bench_now();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		linear11_array_scalar(raw, out, BENCH_SAMPLES);
+	bench_report("scalar", start, bench_sum(out));
+
+	start = bench_now();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		linear11_array_milli(raw, mout, BENCH_SAMPLES);
+	bench_report("integer, thousandths", start, bench_sum_milli(mout));
+
+	start = bench_now();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		linear11_array_lut(raw, out, BENCH_SAMPLES);
+	bench_report("table", start, bench_sum(out));
+
+	start = bench_now();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		linear11_array_milli_lut(raw, mout, BENCH_SAMPLES);
+	bench_report("table, thousandths", start, bench_sum_milli(mout));
+
+#if defined(HAVE_AVX2_TARGET)
+	if (__builtin_cpu_supports("avx2")) {
+		start = bench_now();
+		for (round = 0; round < BENCH_ROUNDS; round++)
+			linear11_array_avx2(raw, out, BENCH_SAMPLES);
+		bench_report("avx2", start, bench_sum(out));
 	}
+#endif
+#if defined(__SSE2__)
+	start = bench_now();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		linear11_array_sse2(raw, out, BENCH_SAMPLES);
+	bench_report("sse2", start, bench_sum(out));
+#endif
+#if defined(__ARM_NEON)
+	start = bench_now();
+	for (round = 0; round < BENCH_ROUNDS; round++)
+		linear11_array_neon(raw, out, BENCH_SAMPLES);
+	bench_report("neon", start, bench_sum(out));
+#endif
+}
 
-	/*
-	 * We may not find out anything about the device in the code above;
-	 * PMBUS 1.1 conformant devices only need to implement ONE command
-	 * that's not manufacturer-specific.
-	 *
-	 * REVISIT support part definition files, probably using XML as a
-	 * relatively neutral syntax that's easily extended and manipulated,
-	 * and which doesn't need Yet Another Lowlevel Parser.
-	 *
-	 *  - They should be able to represent all the data we can query
-	 *    from fully dynamic PMBus 1.1 devices.
-	 *
-	 *  - And support lookup by basic product ID strings, for PMBus 1.0
-	 *    devices that may expose little more than those strings and
-	 *    some sensor/control attributes.
-	 *
-	 *  - Provide a "dump" option, to generate those files for devices
-	 *    which do happen to be fully query-able.
-	 *
-	 *  - Allow cross-validation (file against device, to find bugs),
-	 *    and merging (file adds extra data, e.g. coefficients from
-	 *    docs rather than by protocol requests).
-	 *
-	 *  - File should be able to describe things like manufacturer
-	 *    specific commands, format of user data, accuracy, how the
-	 *    various controls and sensors work in the local environment,
-	 *    what "pages" exist (and what each one does), and so on.
-	 *
-	 * Doing all that usefully depends on having a variety of PMBus
-	 * based products running Linux.  At this writing there aren't
-	 * very many of them, although some recent Dell rackmount servers
-	 * are described as having PMBus support.
-	 */
+static int pmbus_bench_decode(void)
+{
+	static u16	raw[BENCH_SAMPLES], raw2[BENCH_SAMPLES];
+	static float	out[BENCH_SAMPLES], check[BENCH_SAMPLES];
+	static long long mout[BENCH_SAMPLES];
+	struct pmbus_cmd_state st = { .c[1] = { .m = 5, .b = -3, .R = -2, }, };
+	struct pmbus_coefficients *c = &st.c[1];
+	unsigned	i, round, seed = 1;
+	double		start;
+
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		raw[i] = seed;
+	}
+
+	/* all decoders must agree, for every possible encoding */
+	for (i = 0; i < 0x10000; i++)
+		raw[i % BENCH_SAMPLES] = i;
+	linear11_array_scalar(raw, check, BENCH_SAMPLES);
+	pmbus_linear11_array(raw, out, BENCH_SAMPLES);
+	if (memcmp(out, check, sizeof out) != 0) {
+		fprintf(stderr, "LINEAR11 array decoder is broken\n");
+		return 1;
+	}
+	linear11_array_milli(raw, mout, BENCH_SAMPLES);
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		if (mout[i] != llround(check[i] * 1000.0)) {
+			fprintf(stderr, "LINEAR11 integer decoder is broken "
+					"for %04x\n", raw[i]);
+			return 1;
+		}
+	}
+	pmbus_coefficients_prepare(c);
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		long long mx = pmbus_direct_milli(c, (s16) raw[i]);
+
+		if (llabs(mx - llround(pmbus_convert_from_direct(&st,
+					(s16) raw[i]) * 1000.0)) > 1) {
+			fprintf(stderr, "DIRECT integer decoder is broken "
+					"for %04x\n", raw[i]);
+			return 1;
+		}
+	}
+
+	start = bench_now();
+	if (!pmbus_linear11_lut() || !pmbus_linear11_milli_lut()) {
+		fprintf(stderr, "no memory for LINEAR11 tables\n");
+		return 1;
+	}
+	printf("LINEAR11 tables built in %.0f usec\n",
+			(bench_now() - start) * 1e6);
+	linear11_array_lut(raw, out, BENCH_SAMPLES);
+	linear11_array_milli_lut(raw, mout + BENCH_SAMPLES / 2, BENCH_SAMPLES / 2);
+	if (memcmp(out, check, sizeof out) != 0
+			|| memcmp(mout, mout + BENCH_SAMPLES / 2,
+				(BENCH_SAMPLES / 2) * sizeof *mout) != 0) {
+		fprintf(stderr, "LINEAR11 tables are broken\n");
+		return 1;
+	}
+
+	printf("LINEAR11, %u random samples x %u:\n",
+			BENCH_SAMPLES, BENCH_ROUNDS);
+	bench_linear11(raw, out, mout);
+
+	/* a handful of sensors, each near some operating point */
+	for (i = 0; i < BENCH_SAMPLES; i++)
+		raw2[i] = raw[0x10000 + i % 16] ^ (raw[BENCH_SAMPLES - 1 - i] & 0x3);
+	printf("LINEAR11, %u samples x %u, few distinct values:\n",
+			BENCH_SAMPLES, BENCH_ROUNDS);
+	bench_linear11(raw2, out, mout);
+
+	printf("DIRECT (m %d, b %d, R %d):\n", c->m, c->b, c->R);
+
+	start = bench_now();
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (i = 0; i < BENCH_SAMPLES; i++)
+			out[i] = pmbus_convert_from_direct(&st, (s16) raw[i]);
+	}
+	bench_report("double", start, bench_sum(out));
+
+	start = bench_now();
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		for (i = 0; i < BENCH_SAMPLES; i++)
+			mout[i] = pmbus_direct_milli(c, (s16) raw[i]);
+	}
+	bench_report("integer, thousandths", start, bench_sum_milli(mout));
 
 	return 0;
 }
 
 /*----------------------------------------------------------------------*/
 
-static const unsigned long i2c_func_pmbus_min
-		= I2C_FUNC_SMBUS_BYTE_DATA
-		| I2C_FUNC_SMBUS_WORD_DATA
-		| I2C_FUNC_SMBUS_PROC_CALL;
-
 int main(int argc, char **argv)
 {
 	int			c;
 	struct pmbus_dev	dev;
 	char			*adapter = "/dev/i2c-0";
-	char			*addr_tail;
+	char			*daemon_path = NULL;
 	int			addr;
 	bool			clear = false;
 	bool			force = false;
@@ -1968,28 +6658,74 @@ int main(int argc, char **argv)
 	u8			mfr_cmd = 0;
 	char			*page_str = NULL;
 	int			page = -1;
+	bool			dump = false;
+	bool			batch = false;
+	bool			scan_all = false;
+	char			*check_path = NULL;
+	static const struct option long_options[] = {
+		{ "dump-profile",	no_argument,		NULL, 'D' },
+		{ "profile",		required_argument,	NULL, 'P' },
+		{ "check-profile",	required_argument,	NULL, 'K' },
+		{ "bench-decode",	no_argument,		NULL, 'B' },
+		{ "milli",		no_argument,		NULL, 'M' },
+		{ "lut",		no_argument,		NULL, 'T' },
+		{ "daemon",		required_argument,	NULL, 'd' },
+		{ "batch",		no_argument,		NULL, 'I' },
+		{ "scan-all",		no_argument,		NULL, 'A' },
+		{ "batch-query",	no_argument,		NULL, 'Q' },
+		{ }
+	};
 
-	while ((c = getopt(argc, argv, "b:Cfg:lpsv"
+	while ((c = getopt_long(argc, argv, "Ab:BCd:Dfg:IK:lMNP:pQsTv"
 #ifdef HACK
 			"m:"
 #endif
-			)) != EOF) {
+			, long_options, NULL)) != EOF) {
 		switch (c) {
+		case 'A':
+			scan_all = true;
+			continue;
 		case 'b':
 			adapter = optarg;
 			continue;
+		case 'B':
+			return pmbus_bench_decode();
 		case 'C':
 			clear = true;
 			continue;
+		case 'd':
+			daemon_path = optarg;
+			continue;
+		case 'D':
+			dump = true;
+			use_cache = 0;
+			continue;
 		case 'f':
 			force = true;
 			continue;
 		case 'g':
 			page_str = optarg;
 			continue;
+		case 'I':
+			batch = true;
+			continue;
+		case 'K':
+			check_path = optarg;
+			use_cache = 0;
+			continue;
 		case 'l':
 			list = true;
 			continue;
+		case 'M':
+			milli = 1;
+			continue;
+		case 'N':
+			use_cache = 0;
+			continue;
+		case 'P':
+			profile_path = optarg;
+			use_cache = 0;
+			continue;
 #ifdef HACK
 		case 'm':
 			c = atoi(optarg);
@@ -2004,9 +6740,15 @@ int main(int argc, char **argv)
 		case 'p':
 			enable_pec = 1;
 			continue;
+		case 'Q':
+			batch_query = 1;
+			continue;
 		case 's':
 			show = true;
 			continue;
+		case 'T':
+			use_lut = 1;
+			continue;
 		case 'v':
 			verbose++;
 			continue;
@@ -2016,6 +6758,19 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (scan_all)
+		return pmbus_scan_all(argv + optind, argc - optind);
+
+	if (daemon_path || batch) {
+		if (optind != argc) {
+			fprintf(stderr, "too many arguments\n");
+			goto usage;
+		}
+		if (batch)
+			return pmbus_batch_run();
+		return pmbus_daemon_run(daemon_path);
+	}
+
 	if (optind == argc || *argv[optind] == '\0') {
 		fprintf(stderr, "missing device address\n");
 		goto usage;
@@ -2024,19 +6779,9 @@ int main(int argc, char **argv)
 		fprintf(stderr, "too many arguments\n");
 		goto usage;
 	}
-	addr = (int) strtol(argv[optind], &addr_tail, 0);
-	if (*addr_tail || addr < 0) {
-		fprintf(stderr, "'%s' is not a device address\n", optarg);
-		goto usage;
-	}
-
-	/* SMBUS 2.0 table 4 lists reserved addresses */
-	if (addr < 0x09 || addr > 0x77 || addr == 0x0c || addr == 0x28
-				|| addr == 0x37 || addr == 0x61) {
-		fprintf(stderr, "%#02x' is a reserved device address\n",
-				addr);
+	addr = pmbus_parse_addr(argv[optind]);
+	if (addr < 0)
 		goto usage;
-	}
 
 	if (page_str) {
 		char *end;
@@ -2047,65 +6792,14 @@ int main(int argc, char **argv)
 		}
 	}
 
-	/*
-	 * Set up a handle for the specified device on its bus.
-	 */
-	memset(&dev, 0, sizeof dev);
-	dev.fd = open(adapter, O_RDWR);
-	if (dev.fd < 0) {
-		perror(adapter);
-		fprintf(stderr, "Couldn't connect to I2C bus %s\n", adapter);
-		return 1;
-	}
-	dev.bus = adapter;
-
-	c = ioctl(dev.fd, I2C_FUNCS, &dev.funcs);
-	if (c < 0) {
-		perror(adapter);
-		fprintf(stderr, "%s: Couldn't get funcs\n", adapter);
-		return 1;
-	}
-
-	/* Trying for portability here.  We want to support all core PMBus
-	 * features.  Minimal SMBus support is almost good enough ... except
-	 * for block read/write and block proc calls.  So we insist on I2C
-	 * where the SMBus support is weak, and if it's available we also use
-	 * it to cope with the annoying "refuse to do 33+ byte blocks" limit.
-	 *
-	 * NOTE: WRITE_BLOCK isn't currently used -- or required -- so the
-	 * pmbus_block_write() method might fail on some systems.  If that
-	 * matters in your usage, add another test ...
-	 */
-	if ((dev.funcs & i2c_func_pmbus_min) != i2c_func_pmbus_min
-			|| !(dev.funcs & (I2C_FUNC_SMBUS_READ_BLOCK_DATA
-						| I2C_FUNC_I2C))
-			|| !(dev.funcs & (I2C_FUNC_SMBUS_BLOCK_PROC_CALL
-						| I2C_FUNC_I2C))
-			) {
-		fprintf(stderr, "%s: Funcs don't support PMBus\n", adapter);
-		return 1;
-	}
-
-	/* some adapter drivers don't support PEC */
-	if (!(dev.funcs & I2C_FUNC_SMBUS_PEC) && enable_pec) {
-		fprintf(stderr, "%s: No PEC support\n", adapter);
-		enable_pec = 0;
-	}
-
-	c = ioctl(dev.fd, force ? I2C_SLAVE_FORCE : I2C_SLAVE, addr);
-	if (c < 0) {
-		perror(adapter);
-		fprintf(stderr, "Couldn't %sattach to device %#02x\n",
-				force ? "force " : "", addr);
+	if (pmbus_dev_open(&dev, adapter, addr, force, NULL) < 0)
 		return 1;
-	}
-	dev.addr = addr;
 
 	if (pmbus_dev_scan(&dev) < 0)
 		return 1;
 
 	if (page != -1) {
-		c = pmbus_write_byte_data(dev.fd, 0x00, page);
+		c = pmbus_write_byte_data(&dev, PMB_PAGE, page);
 		if (c < 0) {
 			fprintf(stderr, "PAGE command failed: %s\n", strerror(c));
 			return 1;
@@ -2118,6 +6812,27 @@ int main(int argc, char **argv)
 	if (clear)
 		pmbus_clear_fault(&dev);
 
+	if (dump) {
+		if (!dev.ident[0])
+			pmbus_dev_identify(&dev);
+		pmbus_dev_resolve(&dev, NULL);
+		if (dev.no_query)
+			fprintf(stderr, "Device can't QUERY; "
+					"profile is incomplete\n");
+		pmbus_profile_write(&dev, stdout);
+	}
+
+	if (check_path) {
+		c = pmbus_profile_check(&dev, check_path);
+		if (c < 0)
+			fprintf(stderr, "%s: can't load profile: %s\n",
+					check_path, strerror(-c));
+		if (c != 0) {
+			pmbus_dev_close(&dev);
+			return 1;
+		}
+	}
+
 #ifdef HACK
 	if (mfr_cmd && checksupport(&dev, mfr_cmd) == 0) {
 		printf("Unsuppported mfr_specific command: %#02x\n", mfr_cmd);
@@ -2131,35 +6846,66 @@ int main(int argc, char **argv)
 		/* NOTE: manufacturer commands can be of arbitrary syntax;
 		 * the hack here is that we "know" it's write-only, no-data.
 		 */
-		c = smbus_write_byte(dev.fd, mfr_cmd);
+		c = smbus_write_byte(&dev, mfr_cmd);
 		if (c < 0)
 			fprintf(stderr, "Error %d on mfr cmd %#02x\n",
 					c, mfr_cmd);
 	}
 #endif
 
+	if (use_cache)
+		pmbus_cache_save(&dev);
+
+	pmbus_dev_close(&dev);
 	return 0;
 
 usage:
 	fprintf(stderr,
 		"Usage: %s [options] addr\n"
+		"       %s [options] --daemon CONFIG\n"
+		"       %s [options] --batch < OPERATIONS\n"
+		"       %s [options] --scan-all [BUS ...]\n"
 		"  SMBus address may be in hex, decimal, or octal.\n"
 		"  Valid addresses include 0x09-0x77, with exceptions\n"
 		"\n"
 		"Options include:\n"
+		"  -A, --scan-all   find devices on all (or the listed) buses,\n"
+		"                   and list them\n"
 		"  -b /dev/i2c-X    specify I2C bus adapter for bus X\n"
 		"                   (default bus is i2c-0)\n"
+		"  -b sim[:opts]    use a simulated PMBus device instead\n"
+		"  -B, --bench-decode\n"
+		"                   benchmark the numeric decoders, then exit\n"
 		"  -C               clear all status flags\n"
+		"  -d, --daemon CONFIG\n"
+		"                   keep polling the devices listed in CONFIG,\n"
+		"                   publishing their values in state files\n"
+		"  -D, --dump-profile\n"
+		"                   write the device's profile to stdout\n"
 		"  -f               bypass 'address in use' checks\n"
 		"                   (needed with new-style I2C systems)\n"
 		"  -g 0x01          specify PAGE number to use\n"
+		"  -I, --batch      run device operations read from stdin\n"
+		"  -K, --check-profile FILE\n"
+		"                   report where the device disagrees with FILE\n"
 		"  -l               list device capabilities\n"
+		"  -M, --milli      show values as integer thousandths (millivolts\n"
+		"                   etc), decoded without floating point\n"
+		"  -N               don't use cached device profiles\n"
+		"  -P, --profile FILE\n"
+		"                   use FILE instead of QUERY and COEFFICIENTS;\n"
+		"                   if FILE is a directory, look up the device\n"
+		"                   there by its MFR_ID etc\n"
 #ifdef HACK
 		"  -m NN            issue no-param mfr_specific_NN\n"
 #endif
 		"  -p               enable PEC, if the device supports it\n"
+		"  -Q, --batch-query\n"
+		"                   pipeline QUERY calls, for devices that don't\n"
+		"                   need a pause after each\n"
 		"  -s               show device status and attribute values\n"
+		"  -T, --lut        decode LINEAR11 values with lookup tables\n"
 		"  -v               be more verbose\n"
-		, argv[0]);
+		, argv[0], argv[0], argv[0], argv[0]);
 	return 1;
 }